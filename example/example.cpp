@@ -29,6 +29,11 @@
             for(int i=0; i<responseParser.byteCount(); i++) Serial1.print(payload[i], HEX);
             Serial1.print("\n");
             doRequest();
+        } else if (status == ParserState::exception){
+            Serial1.print("EXCEPTION: ");
+            Serial1.print(static_cast<int>(responseParser.errorCode()));
+            Serial1.print("\n");
+            doRequest();
         } else if (status == ParserState::error){
             Serial1.print("ERROR: ");
             Serial1.print(static_cast<int>(responseParser.errorCode()));
@@ -0,0 +1,50 @@
+    /*
+    This example is showing a master with adaptive timeouts.
+    Instead of waiting a fixed time for the response, the deadline manager learns
+    the latency of the slave and resets the parser when the slave does not answer in time.
+    */
+    #include <Arduino.h>
+    #include "mbparser.h"
+    #include "mbdeadline.h"
+    
+    ResponseParser responseParser{};
+    DeadlineManager<ResponseParser> deadlines{};
+    uint16_t transaction{MBDEADLINE_INVALID};
+
+    void doRequest(){
+        uint8_t request[8] = {0x01, 0x04, 0x00, 0x00, 0x00, 0x06, 0x70, 0x08};
+        for (int i =0; i <8; i++) Serial.write(request[i]);
+        Serial.flush();
+        transaction = deadlines.start(&responseParser, 1, millis());
+    }
+
+    void onTimeout(DeadlineManager<ResponseParser> *manager, uint8_t slave, ResponseParser *parser){
+        Serial1.print("TIMEOUT\n");
+        doRequest();
+    }
+
+    void setup(){
+        Serial.begin(9600); // slave
+        Serial1.begin(9600); // debug interface
+        deadlines.setLimits(20, 500);
+        deadlines.setOnTimeoutCB(onTimeout);
+        doRequest();
+    }
+
+    void loop(){
+        ParserState status{ParserState::slaveAddress};
+        if(Serial.available()){
+            status = responseParser.parse(Serial.read());
+        }
+        if (status == ParserState::complete || status == ParserState::exception){
+            deadlines.complete(transaction, millis());
+            Serial1.print("Latency: ");
+            Serial1.print(deadlines.latency(1));
+            Serial1.print("\n");
+            doRequest();
+        } else if (status == ParserState::error){
+            deadlines.cancel(transaction);
+            doRequest();
+        }
+        deadlines.advance(millis());
+    }
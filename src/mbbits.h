@@ -0,0 +1,166 @@
+/*
+mbbits.h
+
+Contains:
+Definition of ModbusBits, bulk helpers to unpack and pack the bit payload of
+FC01, FC02 and FC15 frames.
+
+Remarks:
+Modbus packs coils LSB first: coil n is bit n % 8 of byte n / 8, unused bits of the last byte are zero.
+unpack writes one byte (0 or 1) per coil, pack reads one byte per coil (non zero is on).
+
+On x86 with SSE2 16 coils are handled per step: two payload bytes are broadcast to 16 lanes and
+masked for unpack, 16 coil bytes are compared against zero and collected with movemask for pack.
+Other targets unpack four coils per step with a multiply, which spreads a nibble into four bytes.
+The SIMD path can be disabled with -D MBBITS_NO_SIMD.
+*/
+#ifndef mbbits_h
+#define mbbits_h
+
+#include "mbparser.h"
+#include "mbframe.h"
+
+#if defined(__SSE2__) && !defined(MBBITS_NO_SIMD)
+#include <emmintrin.h>
+#define MBBITS_SSE2
+// the C++ runtime pulled in by emmintrin.h undefines min and max of mbparser.h
+#ifndef min
+#define min(a,b) (((a)<(b))?(a):(b))
+#endif
+#ifndef max
+#define max(a,b) (((a)>(b))?(a):(b))
+#endif
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MBBITS_SWAR
+#endif
+
+class ModbusBits{
+  public:
+    /*
+    True if byteCount is the packed size of quantity coils.
+    */
+    static bool isValid(uint16_t quantity, uint16_t byteCount){
+      return quantity > 0 && quantity <= MB_MAX_READ_BITS && byteCount == (quantity + 7) / 8;
+    }
+
+    /*
+    Unpacks quantity coils of data into out.
+    */
+    static void unpack(const uint8_t *data, uint16_t quantity, uint8_t *out){
+      uint16_t idx = 0;
+#ifdef MBBITS_SSE2
+      const __m128i mask = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+      const __m128i one = _mm_set1_epi8(1);
+      for (; idx + 16 <= quantity; idx += 16){
+        const uint8_t *bytes = data + idx / 8;
+        __m128i x = _mm_cvtsi32_si128(bytes[0] | (bytes[1] << 8));
+        x = _mm_unpacklo_epi8(x, x);
+        x = _mm_unpacklo_epi16(x, x);
+        x = _mm_unpacklo_epi32(x, x);
+        x = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(x, mask), mask), one);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + idx), x);
+      }
+#elif defined(MBBITS_SWAR)
+      for (; idx + 8 <= quantity; idx += 8){
+        uint8_t byte = data[idx / 8];
+        uint32_t low = _spread(byte & 0x0F);
+        uint32_t high = _spread(byte >> 4);
+        memcpy(out + idx, &low, 4);
+        memcpy(out + idx + 4, &high, 4);
+      }
+#endif
+      for (; idx < quantity; idx++){
+        out[idx] = (data[idx / 8] >> (idx % 8)) & 0x01;
+      }
+    }
+
+    static void unpack(const uint8_t *data, uint16_t quantity, bool *out){
+      unpack(data, quantity, reinterpret_cast<uint8_t*>(out));
+    }
+
+    /*
+    Unpacks the payload of a completed FC01 or FC02 response.
+    quantity is taken from the request.
+    Returns false if the payload does not hold quantity coils.
+    */
+    static bool unpack(const ResponseParser &parser, uint16_t quantity, uint8_t *out){
+      if (!parser.isComplete() || parser.functionCode() > 0x02 || !isValid(quantity, parser.byteCount())
+          || parser.data() == nullptr){
+        return false;
+      }
+      unpack(parser.data(), quantity, out);
+      return true;
+    }
+
+    /*
+    Unpacks the payload of a completed FC15 request.
+    out must hold quantity() bytes.
+    */
+    static bool unpack(const RequestParser &parser, uint8_t *out){
+      if (!parser.isComplete() || parser.functionCode() != 0x0F || parser.quantity() > MB_MAX_WRITE_BITS
+          || !isValid(parser.quantity(), parser.byteCount()) || parser.data() == nullptr){
+        return false;
+      }
+      unpack(parser.data(), parser.quantity(), out);
+      return true;
+    }
+
+    /*
+    Packs quantity coils of in into data.
+    Returns the byte count.
+    */
+    static uint8_t pack(const uint8_t *in, uint16_t quantity, uint8_t *data){
+      uint16_t idx = 0;
+#ifdef MBBITS_SSE2
+      const __m128i zero = _mm_setzero_si128();
+      for (; idx + 16 <= quantity; idx += 16){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + idx));
+        uint16_t bits = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero));
+        data[idx / 8] = lowByte(bits);
+        data[idx / 8 + 1] = highByte(bits);
+      }
+#endif
+      for (; idx + 8 <= quantity; idx += 8){
+        const uint8_t *coils = in + idx;
+        data[idx / 8] = (coils[0] != 0) | (coils[1] != 0) << 1 | (coils[2] != 0) << 2 | (coils[3] != 0) << 3
+                      | (coils[4] != 0) << 4 | (coils[5] != 0) << 5 | (coils[6] != 0) << 6 | (coils[7] != 0) << 7;
+      }
+      if (idx < quantity){
+        uint8_t byte = 0;
+        for (uint8_t bit = 0; idx + bit < quantity; bit++){
+          byte |= (in[idx + bit] != 0) << bit;
+        }
+        data[idx / 8] = byte;
+      }
+      return (quantity + 7) / 8;
+    }
+
+    static uint8_t pack(const bool *in, uint16_t quantity, uint8_t *data){
+      return pack(reinterpret_cast<const uint8_t*>(in), quantity, data);
+    }
+
+    static bool getBit(const uint8_t *data, uint16_t idx){
+      return (data[idx / 8] >> (idx % 8)) & 0x01;
+    }
+
+    static void setBit(uint8_t *data, uint16_t idx, bool value){
+      if (value){
+        data[idx / 8] |= 1 << (idx % 8);
+      } else {
+        data[idx / 8] &= ~(1 << (idx % 8));
+      }
+    }
+
+  private:
+    /*
+    Spreads the bits of a nibble into the bytes of a little endian word.
+    */
+    static uint32_t _spread(uint8_t nibble){
+      uint32_t x = (nibble * 0x01010101UL) & 0x08040201UL;
+      return ((x + 0x7F7F7F7FUL) >> 7) & 0x01010101UL;
+    }
+};
+
+#endif
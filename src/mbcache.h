@@ -0,0 +1,244 @@
+/*
+mbcache.h
+
+Contains:
+Definition of ReadCache, a cache of read responses with per range time to live.
+
+Remarks:
+Entries are keyed by slave, function code, address and quantity of the read request.
+The payload of a completed ResponseParser is copied into the entry. A hit rebuilds the
+response PDU from the cached payload, the bus is not touched.
+
+How long a response is fresh is set per register range with setTTL, the first matching
+range wins. Requests without a matching range use the default TTL, which is zero (not cached).
+A write invalidates cached reads of the same slave and table which overlap the written range.
+
+The cache is used by ModbusGateway, see setCache, but works with any master.
+
+Sizes are fixed at compile time and can be changed with
+-D MBCACHE_ENTRIES=n and -D MBCACHE_RULES=n
+*/
+#ifndef mbcache_h
+#define mbcache_h
+
+#include "mbparser.h"
+#include "mbframe.h"
+
+#ifndef MBCACHE_ENTRIES
+#define MBCACHE_ENTRIES 16
+#endif
+
+#ifndef MBCACHE_RULES
+#define MBCACHE_RULES 8
+#endif
+
+#define MBCACHE_PAYLOAD 250
+
+class ReadCache{
+  public:
+    ReadCache(){};
+    ReadCache(const ReadCache&) = delete;
+    ReadCache& operator= (const ReadCache&) = delete;
+
+    /*
+    Sets the time to live of reads of slave with function code fc within address and quantity.
+    Returns false if too many ranges are set.
+    */
+    bool setTTL(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity, unsigned long ttl){
+      if (_ruleCount == MBCACHE_RULES){
+        return false;
+      }
+      Rule &rule = _rules[_ruleCount++];
+      rule.slave = slave;
+      rule.functionCode = fc;
+      rule.address = address;
+      rule.quantity = quantity;
+      rule.ttl = ttl;
+      return true;
+    }
+
+    /*
+    Sets the time to live of reads without matching range.
+    Default is zero, i.e. only reads within a range are cached.
+    */
+    void setDefaultTTL(unsigned long ttl){
+      _defaultTTL = ttl;
+    }
+
+    /*
+    Returns the time to live of a read.
+    */
+    unsigned long ttl(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity) const {
+      for (uint8_t idx = 0; idx < _ruleCount; idx++){
+        const Rule &rule = _rules[idx];
+        if (rule.slave == slave && rule.functionCode == fc && address >= rule.address
+            && uint32_t(address) + quantity <= uint32_t(rule.address) + rule.quantity){
+          return rule.ttl;
+        }
+      }
+      return _defaultTTL;
+    }
+
+    /*
+    Stores the completed response of a read at time now.
+    Returns false if the read is not cached.
+    */
+    bool store(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity, const ResponseParser &parser, unsigned long now){
+      if (!parser.isComplete() || parser.functionCode() != fc || fc < 0x01 || fc > 0x04
+          || parser.byteCount() > MBCACHE_PAYLOAD || parser.data() == nullptr){
+        return false;
+      }
+      unsigned long entryTTL = ttl(slave, fc, address, quantity);
+      if (entryTTL == 0){
+        return false;
+      }
+      Entry &entry = _slot(slave, fc, address, quantity, now);
+      entry.used = true;
+      entry.slave = slave;
+      entry.functionCode = fc;
+      entry.address = address;
+      entry.quantity = quantity;
+      entry.storedAt = now;
+      entry.ttl = entryTTL;
+      entry.byteCount = parser.byteCount();
+      memcpy(entry.data, parser.data(), entry.byteCount);
+      return true;
+    }
+
+    /*
+    Builds the response PDU (function code + byte count + data) of a fresh cached read.
+    Returns zero on a miss.
+    */
+    uint16_t responsePDU(uint8_t *buffer, uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity, unsigned long now){
+      int8_t idx = _find(slave, fc, address, quantity);
+      if (idx < 0 || !_isFresh(_entries[idx], now)){
+        _misses++;
+        return 0;
+      }
+      _hits++;
+      const Entry &entry = _entries[idx];
+      uint16_t len = 0;
+      buffer[len++] = fc;
+      buffer[len++] = entry.byteCount;
+      memcpy(buffer + len, entry.data, entry.byteCount);
+      return len + entry.byteCount;
+    }
+
+    /*
+    Drops cached reads which overlap a write of slave with function code fc.
+    FC05 and FC15 drop coils (FC01), FC06 and FC16 drop holding registers (FC03).
+    */
+    void invalidate(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity){
+      uint8_t table = fc == 0x05 || fc == 0x0F ? 0x01 : 0x03;
+      for (uint8_t idx = 0; idx < MBCACHE_ENTRIES; idx++){
+        Entry &entry = _entries[idx];
+        if (entry.used && entry.slave == slave && entry.functionCode == table
+            && entry.address < uint32_t(address) + quantity && address < uint32_t(entry.address) + entry.quantity){
+          entry.used = false;
+        }
+      }
+    }
+
+    /*
+    Drops all cached reads of slave.
+    */
+    void invalidate(uint8_t slave){
+      for (uint8_t idx = 0; idx < MBCACHE_ENTRIES; idx++){
+        if (_entries[idx].slave == slave){
+          _entries[idx].used = false;
+        }
+      }
+    }
+
+    void clear(){
+      for (uint8_t idx = 0; idx < MBCACHE_ENTRIES; idx++){
+        _entries[idx].used = false;
+      }
+    }
+
+    // ---GETTERS---
+
+    uint32_t hits() const {
+      return _hits;
+    }
+
+    uint32_t misses() const {
+      return _misses;
+    }
+
+    uint8_t entries() const {
+      uint8_t count = 0;
+      for (uint8_t idx = 0; idx < MBCACHE_ENTRIES; idx++){
+        count += _entries[idx].used;
+      }
+      return count;
+    }
+
+  private:
+    struct Rule{
+      uint8_t slave;
+      uint8_t functionCode;
+      uint16_t address;
+      uint16_t quantity;
+      unsigned long ttl;
+    };
+
+    struct Entry{
+      bool used{false};
+      uint8_t slave{0};
+      uint8_t functionCode{0};
+      uint8_t byteCount{0};
+      uint16_t address{0};
+      uint16_t quantity{0};
+      unsigned long storedAt{0};
+      unsigned long ttl{0};
+      uint8_t data[MBCACHE_PAYLOAD];
+    };
+
+    Rule _rules[MBCACHE_RULES];
+    uint8_t _ruleCount{0};
+    unsigned long _defaultTTL{0};
+
+    Entry _entries[MBCACHE_ENTRIES];
+
+    uint32_t _hits{0};
+    uint32_t _misses{0};
+
+    bool _isFresh(const Entry &entry, unsigned long now) const {
+      return now - entry.storedAt < entry.ttl;
+    }
+
+    int8_t _find(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity) const {
+      for (uint8_t idx = 0; idx < MBCACHE_ENTRIES; idx++){
+        const Entry &entry = _entries[idx];
+        if (entry.used && entry.slave == slave && entry.functionCode == fc
+            && entry.address == address && entry.quantity == quantity){
+          return idx;
+        }
+      }
+      return -1;
+    }
+
+    /*
+    Picks the entry for a key: the entry of the key, a free or stale entry or the oldest entry.
+    */
+    Entry& _slot(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity, unsigned long now){
+      int8_t idx = _find(slave, fc, address, quantity);
+      if (idx >= 0){
+        return _entries[idx];
+      }
+      uint8_t oldest = 0;
+      for (uint8_t idx = 0; idx < MBCACHE_ENTRIES; idx++){
+        const Entry &entry = _entries[idx];
+        if (!entry.used || !_isFresh(entry, now)){
+          return _entries[idx];
+        }
+        if (now - entry.storedAt > now - _entries[oldest].storedAt){
+          oldest = idx;
+        }
+      }
+      return _entries[oldest];
+    }
+};
+
+#endif
@@ -0,0 +1,322 @@
+/*
+mbchange.h
+
+Contains:
+Definition of ChangeDetector, which compares the payload of a frame with the payload
+of the previous frame of the same request and reports only the changed ranges.
+Type safe enum for the result of a check.
+
+Remarks:
+A frame is keyed by slave, function code, address and quantity. Each key keeps a fingerprint
+of its last payload and, as long as the image buffer has space, a copy of it.
+Keys with an image report the changed register (FC03, FC04) or coil (FC01, FC02) ranges.
+Keys without an image detect a change by fingerprint only and report the whole payload.
+
+The diff compares four bytes per step and falls back to single registers only where the
+payload differs, so an unchanged payload costs about byteCount / 4 compares.
+
+The number of keys and the size of the image buffer are fixed at compile time and can be changed with
+-D MBCHANGE_MAX_ENTRIES=n and -D MBCHANGE_IMAGE_SIZE=n
+*/
+#ifndef mbchange_h
+#define mbchange_h
+
+#include "mbparser.h"
+
+#ifndef MBCHANGE_MAX_ENTRIES
+#define MBCHANGE_MAX_ENTRIES 16
+#endif
+
+#ifndef MBCHANGE_IMAGE_SIZE
+#define MBCHANGE_IMAGE_SIZE 1024
+#endif
+
+enum class ChangeStatus{
+  unchanged = 0,
+  changed = 1,
+  first = 2,     // first payload of the key
+  untracked = 3  // key table full, payload is passed on; or payload does not match quantity, dropped
+};
+
+class ChangeDetector;
+
+#ifdef STD_FUNCTIONAL
+  typedef std::function<void(ChangeDetector *detector, uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity, const uint8_t *data)> ChangeCallback;
+#else
+  typedef void(*ChangeCallback)(ChangeDetector *detector, uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity, const uint8_t *data);
+#endif
+
+class ChangeDetector{
+  public:
+    ChangeDetector(){};
+    ChangeDetector(const ChangeDetector&) = delete;
+    ChangeDetector& operator= (const ChangeDetector&) = delete;
+
+    /*
+    Sets callback which is called for each changed range.
+    For registers data points to the first changed register.
+    For coils address is a multiple of 8 from the request address and
+    data points to the byte holding it in bit 0.
+    */
+    void setOnChangeCB(ChangeCallback cb){
+      _onChange = cb;
+    }
+
+    /*
+    Sets the number of unchanged registers (or coil bytes) between two changed
+    ranges, up to which the ranges are reported as one. Default is 0.
+    */
+    void setMergeGap(uint8_t gap){
+      _mergeGap = gap;
+    }
+
+    /*
+    Sets void pointer to keep reference to third party objects.
+    */
+    void setExtension(void* ptr){
+      _extension = ptr;
+    }
+
+    void* getExtension(){
+      return _extension;
+    }
+
+    /*
+    Checks the payload of a completed read response.
+    address and quantity are taken from the request.
+    */
+    ChangeStatus check(const ResponseParser &parser, uint16_t address, uint16_t quantity){
+      if (!parser.isComplete() || parser.functionCode() < 0x01 || parser.functionCode() > 0x04){
+        return ChangeStatus::untracked;
+      }
+      return check(parser.slaveAddress(), parser.functionCode(), address, quantity, parser.data(), parser.byteCount());
+    }
+
+    /*
+    Checks a payload in modbus byte order.
+    A payload whose byte count does not match quantity is neither tracked nor passed on.
+    */
+    ChangeStatus check(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity,
+                       const uint8_t *data, uint8_t byteCount){
+      uint32_t expected = fc <= 0x02 ? (uint32_t(quantity) + 7) / 8 : 2 * uint32_t(quantity);
+      if (data == nullptr || quantity == 0 || byteCount != expected){
+        return ChangeStatus::untracked;
+      }
+      int8_t idx = _find(slave, fc, address, quantity);
+      if (idx < 0){
+        idx = _add(slave, fc, address, quantity, byteCount);
+        if (idx < 0){
+          _passed++;
+          _emit(slave, fc, address, quantity, data);
+          return ChangeStatus::untracked;
+        }
+      }
+
+      Entry &entry = _entries[idx];
+      if (!entry.valid){
+        entry.valid = true;
+        _store(entry, data, 0, byteCount);
+        _passed++;
+        _emit(slave, fc, address, quantity, data);
+        return ChangeStatus::first;
+      }
+
+      bool changed = false;
+      if (entry.hasImage){
+        changed = _diff(entry, data);
+      } else {
+        uint32_t fingerprint = _fingerprint(data, byteCount);
+        if (fingerprint != entry.fingerprint){
+          entry.fingerprint = fingerprint;
+          changed = true;
+          _emit(slave, fc, address, quantity, data);
+        }
+      }
+      if (!changed){
+        _suppressed++;
+        return ChangeStatus::unchanged;
+      }
+      _passed++;
+      return ChangeStatus::changed;
+    }
+
+    /*
+    Forgets all keys of slave, e.g. after the slave restarted.
+    Their image space is kept for the same keys.
+    */
+    void invalidate(uint8_t slave){
+      for (uint8_t idx = 0; idx < _count; idx++){
+        if (_entries[idx].slave == slave){
+          _entries[idx].valid = false;
+        }
+      }
+    }
+
+    /*
+    Forgets all keys and images.
+    */
+    void clear(){
+      _count = 0;
+      _imageUsed = 0;
+    }
+
+    // ---GETTERS---
+
+    uint8_t entries() const {
+      return _count;
+    }
+
+    uint16_t imageUsed() const {
+      return _imageUsed;
+    }
+
+    /*
+    Number of frames without change.
+    */
+    uint32_t suppressed() const {
+      return _suppressed;
+    }
+
+    /*
+    Number of frames passed on.
+    */
+    uint32_t passed() const {
+      return _passed;
+    }
+
+  private:
+    struct Entry{
+      uint8_t slave;
+      uint8_t functionCode;
+      uint16_t address;
+      uint16_t quantity;
+      uint8_t byteCount;
+      bool valid; // false until the first payload is stored
+      bool hasImage;
+      uint16_t offset;
+      uint32_t fingerprint;
+    };
+
+    Entry _entries[MBCHANGE_MAX_ENTRIES];
+    uint8_t _count{0};
+    uint8_t _image[MBCHANGE_IMAGE_SIZE];
+    uint16_t _imageUsed{0};
+    uint8_t _mergeGap{0};
+
+    uint32_t _suppressed{0};
+    uint32_t _passed{0};
+
+    ChangeCallback _onChange{nullptr};
+    void* _extension{nullptr};
+
+    int8_t _find(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity) const {
+      for (uint8_t idx = 0; idx < _count; idx++){
+        const Entry &entry = _entries[idx];
+        if (entry.slave == slave && entry.functionCode == fc && entry.address == address && entry.quantity == quantity){
+          return idx;
+        }
+      }
+      return -1;
+    }
+
+    int8_t _add(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity, uint8_t byteCount){
+      if (_count == MBCHANGE_MAX_ENTRIES){
+        return -1;
+      }
+      Entry &entry = _entries[_count];
+      entry.slave = slave;
+      entry.functionCode = fc;
+      entry.address = address;
+      entry.quantity = quantity;
+      entry.byteCount = byteCount;
+      entry.valid = false;
+      entry.hasImage = MBCHANGE_IMAGE_SIZE - _imageUsed >= byteCount;
+      entry.offset = _imageUsed;
+      if (entry.hasImage){
+        _imageUsed += byteCount;
+      }
+      return _count++;
+    }
+
+    void _store(Entry &entry, const uint8_t *data, uint8_t from, uint8_t to){
+      if (entry.hasImage){
+        memcpy(_image + entry.offset + from, data + from, to - from);
+      } else {
+        entry.fingerprint = _fingerprint(data, entry.byteCount);
+      }
+    }
+
+    /*
+    Compares four bytes per step, then single units where the payload differs.
+    Reports and stores each changed range. Returns true if anything changed.
+    */
+    bool _diff(Entry &entry, const uint8_t *data){
+      const uint8_t *image = _image + entry.offset;
+      uint8_t unit = entry.functionCode <= 0x02 ? 1 : 2;
+      uint16_t gap = uint16_t(_mergeGap) * unit;
+      uint8_t len = entry.byteCount;
+      bool changed = false;
+      uint16_t start = 0;
+      uint16_t end = 0;
+      uint16_t idx = 0;
+      while (idx < len){
+        if (idx + 4 <= len && _equal32(image + idx, data + idx)){
+          idx += 4;
+          continue;
+        }
+        if (memcmp(image + idx, data + idx, unit) != 0){
+          if (changed && idx - end > gap){
+            _report(entry, data, start, end);
+            start = idx;
+          } else if (!changed){
+            start = idx;
+          }
+          changed = true;
+          end = idx + unit;
+        }
+        idx += unit;
+      }
+      if (changed){
+        _report(entry, data, start, min(end, uint16_t(len)));
+      }
+      return changed;
+    }
+
+    static bool _equal32(const uint8_t *a, const uint8_t *b){
+      uint32_t x;
+      uint32_t y;
+      memcpy(&x, a, 4);
+      memcpy(&y, b, 4);
+      return x == y;
+    }
+
+    void _report(Entry &entry, const uint8_t *data, uint16_t from, uint16_t to){
+      _store(entry, data, from, to);
+      if (entry.functionCode <= 0x02){
+        uint16_t first = from * 8;
+        uint16_t last = min(uint16_t(to * 8), entry.quantity);
+        _emit(entry.slave, entry.functionCode, entry.address + first, last - first, data + from);
+      } else {
+        _emit(entry.slave, entry.functionCode, entry.address + from / 2, (to - from) / 2, data + from);
+      }
+    }
+
+    void _emit(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity, const uint8_t *data){
+      if (_onChange){
+        _onChange(this, slave, fc, address, quantity, data);
+      }
+    }
+
+    /*
+    FNV-1a of the payload.
+    */
+    static uint32_t _fingerprint(const uint8_t *data, uint8_t len){
+      uint32_t hash = 2166136261UL;
+      for (uint8_t idx = 0; idx < len; idx++){
+        hash = (hash ^ data[idx]) * 16777619UL;
+      }
+      return hash;
+    }
+};
+
+#endif
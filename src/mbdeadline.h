@@ -0,0 +1,385 @@
+/*
+mbdeadline.h
+
+Contains:
+Definition of DeadlineManager, which tracks transaction deadlines of parsers
+in a hierarchical timer wheel and learns the response latency of each slave.
+
+Remarks:
+The parser itself has no notion of time. A slave that never answers or answers partially
+leaves the parser waiting in slaveAddress or data state. The deadline manager resets the
+parser of a transaction when its deadline expires and calls the timeout callback.
+
+The timeout of each slave adapts to its latency like a TCP retransmission timer:
+smoothed latency + 4 * latency variance, clamped to [minTimeout, maxTimeout].
+A timeout doubles the timeout of the slave.
+
+Time is given by the user in ticks, typically millis(). The wheel has two levels of 64 slots
+and covers 4096 ticks; longer timeouts are clamped.
+
+The number of outstanding transactions is fixed at compile time and can be changed with
+-D MBDEADLINE_MAX_TIMERS=n
+*/
+#ifndef mbdeadline_h
+#define mbdeadline_h
+
+#include "mbparser.h"
+
+#ifndef MBDEADLINE_MAX_TIMERS
+#define MBDEADLINE_MAX_TIMERS 16
+#endif
+
+#define MBDEADLINE_WHEEL_BITS 6
+#define MBDEADLINE_WHEEL_SIZE (1 << MBDEADLINE_WHEEL_BITS)
+#define MBDEADLINE_WHEEL_MASK (MBDEADLINE_WHEEL_SIZE - 1)
+#define MBDEADLINE_MAX_TICKS (MBDEADLINE_WHEEL_SIZE * MBDEADLINE_WHEEL_SIZE - 1)
+#define MBDEADLINE_INVALID 0xFFFF
+
+template<typename TParser>
+class DeadlineManager{
+  public:
+#ifdef STD_FUNCTIONAL
+    typedef std::function<void(DeadlineManager *manager, uint8_t slave, TParser *parser)> TimeoutCallback;
+#else
+    typedef void(*TimeoutCallback)(DeadlineManager *manager, uint8_t slave, TParser *parser);
+#endif
+
+    DeadlineManager(){
+      for (uint8_t idx = 0; idx < MBDEADLINE_WHEEL_SIZE; idx++){
+        _wheel[0][idx] = _nil;
+        _wheel[1][idx] = _nil;
+      }
+      for (uint8_t idx = 0; idx < MBDEADLINE_MAX_TIMERS; idx++){
+        _timers[idx].active = false;
+      }
+      for (uint16_t slave = 0; slave < 256; slave++){
+        _resetSlave(slave);
+      }
+    };
+    DeadlineManager(const DeadlineManager&) = delete;
+    DeadlineManager& operator= (const DeadlineManager&) = delete;
+
+    /*
+    Starts a transaction of parser with slave.
+    Call when the request was written.
+    Returns a handle or MBDEADLINE_INVALID when all timers are in use.
+    */
+    uint16_t start(TParser *parser, uint8_t slave, unsigned long now){
+      _advanceTo(now);
+      uint8_t idx = 0;
+      while (idx < MBDEADLINE_MAX_TIMERS && _timers[idx].active){
+        idx++;
+      }
+      if (idx == MBDEADLINE_MAX_TIMERS){
+        return MBDEADLINE_INVALID;
+      }
+      Timer &timer = _timers[idx];
+      timer.active = true;
+      timer.generation++;
+      timer.parser = parser;
+      timer.slave = slave;
+      timer.startedAt = now;
+      timer.deadline = now + max(uint32_t(1), min(_slaves[slave].timeout, uint32_t(MBDEADLINE_MAX_TICKS)));
+      _insert(idx);
+      _activeCount++;
+      return _handle(idx);
+    }
+
+    /*
+    Completes a transaction and learns the latency of the slave.
+    Call when the parser is complete (or received an exception).
+    Returns false if the transaction has already expired.
+    */
+    bool complete(uint16_t handle, unsigned long now){
+      int8_t idx = _lookup(handle);
+      if (idx < 0){
+        return false;
+      }
+      Timer &timer = _timers[idx];
+      _learn(timer.slave, now - timer.startedAt);
+      _remove(idx);
+      return true;
+    }
+
+    /*
+    Cancels a transaction without learning.
+    */
+    bool cancel(uint16_t handle){
+      int8_t idx = _lookup(handle);
+      if (idx < 0){
+        return false;
+      }
+      _remove(idx);
+      return true;
+    }
+
+    /*
+    Advances the wheel to now.
+    Expired transactions reset their parser and call the timeout callback.
+    */
+    void advance(unsigned long now){
+      _advanceTo(now);
+    }
+
+    /*
+    Sets callback which is called for each expired transaction.
+    The parser is already reset. The callback may start a new transaction,
+    callbacks run once the wheel has advanced.
+    */
+    void setOnTimeoutCB(TimeoutCallback cb){
+      _onTimeout = cb;
+    }
+
+    /*
+    Sets bounds of the adaptive timeout in ticks.
+    Learned timeouts are clamped to the new bounds.
+    Defaults are 10 and 1000 ticks.
+    */
+    void setLimits(uint32_t minTimeout, uint32_t maxTimeout){
+      _minTimeout = minTimeout;
+      _maxTimeout = min(maxTimeout, uint32_t(MBDEADLINE_MAX_TICKS));
+      for (uint16_t slave = 0; slave < 256; slave++){
+        Slave &s = _slaves[slave];
+        if (s.samples > 0){
+          s.timeout = max(_minTimeout, min(s.timeout, _maxTimeout));
+        }
+      }
+    }
+
+    /*
+    Sets the timeout of slaves without any latency sample.
+    Default is 100 ticks.
+    */
+    void setInitialTimeout(uint32_t timeout){
+      _initialTimeout = timeout;
+      for (uint16_t slave = 0; slave < 256; slave++){
+        if (_slaves[slave].samples == 0){
+          _slaves[slave].timeout = timeout;
+        }
+      }
+    }
+
+    /*
+    Forgets the learned latency of a slave.
+    */
+    void resetSlave(uint8_t slave){
+      _resetSlave(slave);
+    }
+
+    /*
+    Sets void pointer to keep reference to third party objects.
+    */
+    void setExtension(void* ptr){
+      _extension = ptr;
+    }
+
+    void* getExtension(){
+      return _extension;
+    }
+
+    // ---GETTERS---
+
+    uint32_t timeout(uint8_t slave) const {
+      return _slaves[slave].timeout;
+    }
+
+    /*
+    Smoothed latency of slave in ticks.
+    */
+    uint32_t latency(uint8_t slave) const {
+      return _slaves[slave].srtt >> 3;
+    }
+
+    uint8_t outstanding() const {
+      return _activeCount;
+    }
+
+  private:
+    static const uint8_t _nil{0xFF};
+
+    struct Timer{
+      bool active;
+      uint8_t generation{0};
+      uint8_t slave;
+      uint8_t next;
+      uint8_t prev;
+      uint8_t level;
+      uint8_t slot;
+      TParser *parser;
+      unsigned long startedAt;
+      unsigned long deadline;
+    };
+
+    struct Expired{
+      uint8_t slave;
+      TParser *parser;
+    };
+
+    struct Slave{
+      uint32_t srtt;   // smoothed latency * 8
+      uint32_t rttvar; // latency variance * 4
+      uint32_t timeout;
+      uint16_t samples;
+    };
+
+    Timer _timers[MBDEADLINE_MAX_TIMERS];
+    uint8_t _wheel[2][MBDEADLINE_WHEEL_SIZE];
+    uint8_t _activeCount{0};
+    unsigned long _current{0};
+    bool _started{false};
+
+    Slave _slaves[256];
+    uint32_t _minTimeout{10};
+    uint32_t _maxTimeout{1000};
+    uint32_t _initialTimeout{100};
+
+    TimeoutCallback _onTimeout{nullptr};
+    void* _extension{nullptr};
+
+    uint16_t _handle(uint8_t idx) const {
+      return (uint16_t(_timers[idx].generation) << 8) | idx;
+    }
+
+    int8_t _lookup(uint16_t handle) const {
+      uint8_t idx = lowByte(handle);
+      if (handle == MBDEADLINE_INVALID || idx >= MBDEADLINE_MAX_TIMERS || !_timers[idx].active
+          || _handle(idx) != handle){
+        return -1;
+      }
+      return idx;
+    }
+
+    void _resetSlave(uint8_t slave){
+      _slaves[slave].srtt = 0;
+      _slaves[slave].rttvar = 0;
+      _slaves[slave].samples = 0;
+      _slaves[slave].timeout = _initialTimeout;
+    }
+
+    /*
+    EWMA of latency and its variance (RFC 6298 gains 1/8 and 1/4).
+    */
+    void _learn(uint8_t slave, uint32_t sample){
+      Slave &s = _slaves[slave];
+      if (s.samples == 0){
+        s.srtt = sample << 3;
+        s.rttvar = sample << 1;
+      } else {
+        int32_t delta = int32_t(sample) - int32_t(s.srtt >> 3);
+        s.srtt += delta;
+        if (delta < 0){
+          delta = -delta;
+        }
+        s.rttvar += delta - int32_t(s.rttvar >> 2);
+      }
+      if (s.samples < 0xFFFF){
+        s.samples++;
+      }
+      uint32_t timeout = (s.srtt >> 3) + s.rttvar;
+      s.timeout = max(_minTimeout, min(timeout, _maxTimeout));
+    }
+
+    void _backoff(uint8_t slave){
+      Slave &s = _slaves[slave];
+      s.timeout = min(s.timeout * 2, _maxTimeout);
+    }
+
+    void _insert(uint8_t idx){
+      Timer &timer = _timers[idx];
+      // deadline is never in the past
+      unsigned long delta = timer.deadline - _current;
+      if (delta < MBDEADLINE_WHEEL_SIZE){
+        timer.level = 0;
+        timer.slot = timer.deadline & MBDEADLINE_WHEEL_MASK;
+      } else {
+        timer.level = 1;
+        timer.slot = (timer.deadline >> MBDEADLINE_WHEEL_BITS) & MBDEADLINE_WHEEL_MASK;
+      }
+      uint8_t &head = _wheel[timer.level][timer.slot];
+      timer.prev = _nil;
+      timer.next = head;
+      if (head != _nil){
+        _timers[head].prev = idx;
+      }
+      head = idx;
+    }
+
+    void _unlink(uint8_t idx){
+      Timer &timer = _timers[idx];
+      if (timer.prev != _nil){
+        _timers[timer.prev].next = timer.next;
+      } else {
+        _wheel[timer.level][timer.slot] = timer.next;
+      }
+      if (timer.next != _nil){
+        _timers[timer.next].prev = timer.prev;
+      }
+    }
+
+    void _remove(uint8_t idx){
+      _unlink(idx);
+      _timers[idx].active = false;
+      _activeCount--;
+    }
+
+    /*
+    Advances the wheel, then calls the timeout callbacks. So a callback which starts
+    a transaction finds the wheel at now and no timer list in use.
+    */
+    void _advanceTo(unsigned long now){
+      if (!_started || _activeCount == 0){
+        _current = now;
+        _started = true;
+        return;
+      }
+      Expired expired[MBDEADLINE_MAX_TIMERS];
+      uint8_t count = 0;
+      while (long(now - _current) > 0){
+        if (_activeCount == 0){
+          _current = now;
+          break;
+        }
+        _current++;
+        if ((_current & MBDEADLINE_WHEEL_MASK) == 0){
+          _cascade();
+        }
+        _expire(expired, count);
+      }
+      for (uint8_t idx = 0; idx < count && _onTimeout; idx++){
+        _onTimeout(this, expired[idx].slave, expired[idx].parser);
+      }
+    }
+
+    /*
+    Moves the timers of the next level 1 slot down to level 0.
+    */
+    void _cascade(){
+      uint8_t &head = _wheel[1][(_current >> MBDEADLINE_WHEEL_BITS) & MBDEADLINE_WHEEL_MASK];
+      uint8_t idx = head;
+      head = _nil;
+      while (idx != _nil){
+        uint8_t next = _timers[idx].next;
+        _insert(idx);
+        idx = next;
+      }
+    }
+
+    /*
+    Removes the timers of the current level 0 slot and appends them to expired.
+    */
+    void _expire(Expired *expired, uint8_t &count){
+      uint8_t &head = _wheel[0][_current & MBDEADLINE_WHEEL_MASK];
+      while (head != _nil){
+        uint8_t idx = head;
+        Timer &timer = _timers[idx];
+        _remove(idx);
+        _backoff(timer.slave);
+        timer.parser->reset();
+        expired[count].slave = timer.slave;
+        expired[count].parser = timer.parser;
+        count++;
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,260 @@
+/*
+mbframe.h
+
+Contains:
+Definition of ModbusFrame, a stateless helper to build modbus RTU and TCP frames.
+Definition of MBAPHeader for modbus TCP application protocol headers.
+
+Remarks:
+The parsers only consume frames. Masters, slaves and gateways also need to
+produce them. All builders write into a caller provided buffer and return the
+number of bytes written. No heap is used.
+Words are written in modbus byte order (big endian) independent of the machine.
+*/
+#ifndef mbframe_h
+#define mbframe_h
+
+#include "mbparser.h"
+
+// Protocol limits
+#define MB_RTU_MAX_ADU 256
+#define MB_TCP_MAX_ADU 260
+#define MB_MAX_PDU 253
+#define MB_MBAP_SIZE 7
+#define MB_MAX_READ_REGISTERS 125
+#define MB_MAX_READ_BITS 2000
+#define MB_MAX_WRITE_REGISTERS 123
+#define MB_MAX_WRITE_BITS 1968
+
+/*
+Modbus TCP application protocol header.
+*/
+struct MBAPHeader{
+  uint16_t transactionId;
+  uint16_t protocolId;
+  uint16_t length; // unit id + pdu
+  uint8_t unitId;
+};
+
+class ModbusFrame{
+  public:
+    /*
+    Calculates the CRC16 over len bytes.
+    */
+    static uint16_t crc(const uint8_t *buffer, uint16_t len){
+      uint16_t crc = 0xFFFF;
+      for (uint16_t idx = 0; idx < len; idx++){
+        crc = modbusCRC(crc, buffer[idx]);
+      }
+      return crc;
+    }
+
+    /*
+    Appends the CRC to a frame of len bytes.
+    Returns the new length of the frame.
+    */
+    static uint16_t appendCRC(uint8_t *buffer, uint16_t len){
+      uint16_t crc = ModbusFrame::crc(buffer, len);
+      buffer[len++] = lowByte(crc);
+      buffer[len++] = highByte(crc);
+      return len;
+    }
+
+    /*
+    True when the last two bytes of the frame match the CRC of the frame.
+    */
+    static bool checkCRC(const uint8_t *buffer, uint16_t len){
+      if (len < 3){
+        return false;
+      }
+      uint16_t crc = ModbusFrame::crc(buffer, len - 2);
+      return buffer[len - 2] == lowByte(crc) && buffer[len - 1] == highByte(crc);
+    }
+
+    /*
+    Builds a FC01, FC02, FC03 or FC04 read request.
+    */
+    static uint16_t readRequest(uint8_t *buffer, uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity){
+      uint16_t len = 0;
+      buffer[len++] = slave;
+      buffer[len++] = fc;
+      len = _putWord(buffer, len, address);
+      len = _putWord(buffer, len, quantity);
+      return appendCRC(buffer, len);
+    }
+
+    /*
+    Builds a FC05 or FC06 write single request.
+    The value is written as is. For FC05 use 0xFF00 for on and 0x0000 for off.
+    The response of a write single is an echo of the request.
+    */
+    static uint16_t writeSingle(uint8_t *buffer, uint8_t slave, uint8_t fc, uint16_t address, uint16_t value){
+      return readRequest(buffer, slave, fc, address, value);
+    }
+
+    /*
+    Builds a FC15 or FC16 write multiple request.
+    data must be byteCount bytes and already in modbus byte order.
+    */
+    static uint16_t writeMultiple(uint8_t *buffer, uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity,
+                                  const uint8_t *data, uint8_t byteCount){
+      uint16_t len = 0;
+      buffer[len++] = slave;
+      buffer[len++] = fc;
+      len = _putWord(buffer, len, address);
+      len = _putWord(buffer, len, quantity);
+      buffer[len++] = byteCount;
+      for (uint16_t idx = 0; idx < byteCount; idx++){
+        buffer[len++] = data[idx];
+      }
+      return appendCRC(buffer, len);
+    }
+
+    /*
+    Builds a FC01, FC02, FC03 or FC04 read response.
+    */
+    static uint16_t readResponse(uint8_t *buffer, uint8_t slave, uint8_t fc, const uint8_t *data, uint8_t byteCount){
+      uint16_t len = 0;
+      buffer[len++] = slave;
+      buffer[len++] = fc;
+      buffer[len++] = byteCount;
+      for (uint16_t idx = 0; idx < byteCount; idx++){
+        buffer[len++] = data[idx];
+      }
+      return appendCRC(buffer, len);
+    }
+
+    /*
+    Builds a FC15 or FC16 write multiple response.
+    */
+    static uint16_t writeMultipleResponse(uint8_t *buffer, uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity){
+      return readRequest(buffer, slave, fc, address, quantity);
+    }
+
+    /*
+    Builds an exception response.
+    The exception flag is added to the function code.
+    */
+    static uint16_t exception(uint8_t *buffer, uint8_t slave, uint8_t fc, ErrorCode code){
+      uint16_t len = 0;
+      buffer[len++] = slave;
+      buffer[len++] = fc | 0x80;
+      buffer[len++] = static_cast<uint8_t>(code);
+      return appendCRC(buffer, len);
+    }
+
+    /*
+    Rebuilds the PDU (function code + data) of a completed response.
+    The parser must not swap the payload.
+    Returns zero when parser is not complete or streams its payload (no data()).
+    */
+    static uint16_t responsePDU(uint8_t *buffer, const ResponseParser &parser){
+      if (!parser.isComplete() || parser.data() == nullptr){
+        return 0;
+      }
+      uint16_t len = 0;
+      buffer[len++] = parser.functionCode();
+      switch (parser.functionCode()){
+        case 0x01:
+        case 0x02:
+        case 0x03:
+        case 0x04:
+          buffer[len++] = parser.byteCount();
+          for (uint16_t idx = 0; idx < parser.byteCount(); idx++){
+            buffer[len++] = parser.data()[idx];
+          }
+          break;
+        case 0x05:
+        case 0x06:
+          len = _putWord(buffer, len, parser.address());
+          buffer[len++] = parser.data()[0];
+          buffer[len++] = parser.data()[1];
+          break;
+        case 0x0F:
+        case 0x10:
+          len = _putWord(buffer, len, parser.address());
+          len = _putWord(buffer, len, parser.quantity());
+          break;
+        default:
+          return 0;
+      }
+      return len;
+    }
+
+    /*
+    Writes a MBAP header.
+    length is the size of the following pdu. Unit id is accounted.
+    */
+    static uint16_t mbap(uint8_t *buffer, uint16_t transactionId, uint8_t unitId, uint16_t pduLength){
+      uint16_t len = 0;
+      len = _putWord(buffer, len, transactionId);
+      len = _putWord(buffer, len, 0);
+      len = _putWord(buffer, len, pduLength + 1);
+      buffer[len++] = unitId;
+      return len;
+    }
+
+    /*
+    Reads a MBAP header from buffer.
+    Returns false if buffer is too short or the header is not a modbus header.
+    */
+    static bool readMBAP(const uint8_t *buffer, uint16_t len, MBAPHeader &header){
+      if (len < MB_MBAP_SIZE){
+        return false;
+      }
+      header.transactionId = getWord(buffer);
+      header.protocolId = getWord(buffer + 2);
+      header.length = getWord(buffer + 4);
+      header.unitId = buffer[6];
+      return header.protocolId == 0 && header.length >= 2 && header.length <= MB_MAX_PDU + 1;
+    }
+
+    /*
+    Converts a RTU frame to a TCP ADU. The CRC is dropped.
+    Returns the length of the TCP ADU or zero if frame is invalid.
+    */
+    static uint16_t rtuToTCP(uint8_t *buffer, const uint8_t *rtu, uint16_t len, uint16_t transactionId){
+      if (len < 4 || len > MB_RTU_MAX_ADU){
+        return 0;
+      }
+      uint16_t pduLength = len - 3;
+      uint16_t idx = mbap(buffer, transactionId, rtu[0], pduLength);
+      for (uint16_t i = 0; i < pduLength; i++){
+        buffer[idx++] = rtu[1 + i];
+      }
+      return idx;
+    }
+
+    /*
+    Converts a TCP ADU to a RTU frame. The CRC is appended.
+    Returns the length of the RTU frame or zero if adu is invalid.
+    */
+    static uint16_t tcpToRTU(uint8_t *buffer, const uint8_t *adu, uint16_t len){
+      MBAPHeader header;
+      if (!readMBAP(adu, len, header) || len != header.length + 6){
+        return 0;
+      }
+      uint16_t idx = 0;
+      buffer[idx++] = header.unitId;
+      for (uint16_t i = MB_MBAP_SIZE; i < len; i++){
+        buffer[idx++] = adu[i];
+      }
+      return appendCRC(buffer, idx);
+    }
+
+    /*
+    Reads a big endian word.
+    */
+    static uint16_t getWord(const uint8_t *buffer){
+      return (uint16_t(buffer[0]) << 8) | buffer[1];
+    }
+
+  private:
+    static uint16_t _putWord(uint8_t *buffer, uint16_t idx, uint16_t word){
+      buffer[idx++] = highByte(word);
+      buffer[idx++] = lowByte(word);
+      return idx;
+    }
+};
+
+#endif
@@ -0,0 +1,348 @@
+/*
+mbframebus.h
+
+Contains:
+Definition of FrameBusPublisher, which publishes completed frames into a ring in shared memory.
+Definition of FrameBusSubscriber, which reads the ring without locks.
+Definition of BusFrame, the layout of a published frame.
+
+Remarks:
+The ring lives in memory given by the user. To fan out frames to other processes the memory
+is a shared mapping (e.g. shm_open and mmap), each process maps it and attaches a subscriber.
+Within one process a static array works as well.
+
+There is exactly one publisher. It never waits for subscribers: each slot is guarded by a
+sequence number (seqlock), which is odd while the slot is written. A subscriber checks the
+sequence before and after reading a slot. A subscriber which falls behind by more than the
+ring size detects the overrun, counts the lost frames and continues with the oldest frame
+still available. So slow subscribers never stall the parser.
+
+A publisher which restarts calls begin on the same memory again. begin keeps the magic and
+bumps the generation in the header, which is odd while the ring is formatted. A subscriber
+checks the generation on each read, on a change it continues with the first frame of the
+new publisher and reports restarted. Frames of the old publisher not read yet are dropped.
+
+Publishing is a copy of the frame into the slot and three atomic stores, no system call.
+peek and release give subscribers zero copy access to a slot.
+*/
+#ifndef mbframebus_h
+#define mbframebus_h
+
+#include "mbparser.h"
+
+#define MBFRAMEBUS_MAGIC 0x4D424642UL // "MBFB"
+#define MBFRAMEBUS_PAYLOAD 256
+
+/*
+A published frame. The layout is shared between processes.
+*/
+struct BusFrame{
+  uint32_t timestamp;
+  uint8_t slave;
+  uint8_t functionCode;
+  uint8_t errorCode;
+  uint8_t byteCount;
+  uint16_t address;
+  uint16_t quantity;
+  uint8_t isRequest;
+  uint8_t reserved[3];
+  uint8_t data[MBFRAMEBUS_PAYLOAD];
+};
+
+enum class BusReadStatus{
+  empty = 0,
+  frame = 1,
+  overrun = 2, // frames were lost, the next read continues with the oldest frame
+  restarted = 3 // the publisher restarted, the next read continues with its first frame
+};
+
+class FrameBus{
+  public:
+    /*
+    Bytes of memory needed for a ring of slots frames.
+    */
+    static size_t memorySize(uint32_t slots){
+      return sizeof(Header) + slots * sizeof(Slot);
+    }
+
+  protected:
+    struct Header{
+      uint32_t magic;
+      uint32_t slots;
+      uint32_t slotSize;
+      uint32_t head; // sequence of the next frame
+      uint32_t generation; // 2 * publisher starts, + 1 while formatted
+    };
+
+    struct Slot{
+      uint32_t sequence; // 2 * frame sequence + 1 while written, + 2 when published
+      BusFrame frame;
+    };
+
+    Header *_header{nullptr};
+    Slot *_slots{nullptr};
+
+    static uint32_t _load(const uint32_t *ptr){
+      return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+    }
+
+    static void _store(uint32_t *ptr, uint32_t value){
+      __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+    }
+};
+
+class FrameBusPublisher: public FrameBus{
+  public:
+    FrameBusPublisher(){};
+    FrameBusPublisher(const FrameBusPublisher&) = delete;
+    FrameBusPublisher& operator= (const FrameBusPublisher&) = delete;
+
+    /*
+    Formats memory of size bytes as empty ring.
+    If memory holds a ring of a previous publisher, its subscribers stay attached and
+    continue with the frames of this publisher.
+    memory must be aligned to 4 bytes.
+    Returns false if memory holds less than two slots.
+    */
+    bool begin(uint8_t *memory, size_t size){
+      if (size < memorySize(2)){
+        return false;
+      }
+      _header = reinterpret_cast<Header*>(memory);
+      _slots = reinterpret_cast<Slot*>(memory + sizeof(Header));
+      uint32_t generation = 0;
+      if (_load(&_header->magic) == MBFRAMEBUS_MAGIC){
+        generation = _load(&_header->generation) & ~uint32_t(1);
+      }
+      _store(&_header->generation, generation + 1);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      _header->slots = (size - sizeof(Header)) / sizeof(Slot);
+      _header->slotSize = sizeof(Slot);
+      for (uint32_t idx = 0; idx < _header->slots; idx++){
+        _store(&_slots[idx].sequence, 0);
+      }
+      _store(&_header->head, 0);
+      _store(&_header->magic, MBFRAMEBUS_MAGIC);
+      _store(&_header->generation, generation + 2);
+      return true;
+    }
+
+    /*
+    Publishes a frame. Only byteCount bytes of data are copied.
+    */
+    void publish(const BusFrame &frame){
+      uint32_t sequence = _header->head;
+      Slot &slot = _slots[sequence % _header->slots];
+      _store(&slot.sequence, 2 * sequence + 1);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      memcpy(&slot.frame, &frame, sizeof(BusFrame) - MBFRAMEBUS_PAYLOAD + frame.byteCount);
+      _store(&slot.sequence, 2 * sequence + 2);
+      _store(&_header->head, sequence + 1);
+    }
+
+    /*
+    Publishes a completed or failed frame of a parser at time now.
+    A parser in streaming mode keeps no payload, its frames are published with byteCount zero.
+    */
+    template<typename TParser>
+    void publish(const TParser &parser, unsigned long now){
+      BusFrame &frame = _frame;
+      frame.timestamp = now;
+      frame.slave = parser.slaveAddress();
+      frame.functionCode = parser.functionCode();
+      frame.errorCode = static_cast<uint8_t>(parser.errorCode());
+      frame.isRequest = _isRequest(&parser);
+      frame.address = parser.address();
+      frame.quantity = parser.quantity();
+      frame.byteCount = 0;
+      if (parser.isComplete() && parser.data() != nullptr){
+        // write single has no byte count but 2 bytes of data
+        frame.byteCount = parser.byteCount() > 0 ? parser.byteCount() : 2;
+        memcpy(frame.data, parser.data(), frame.byteCount);
+      }
+      publish(frame);
+    }
+
+    // ---GETTERS---
+
+    uint32_t published() const {
+      return _header ? _header->head : 0;
+    }
+
+    uint32_t slots() const {
+      return _header ? _header->slots : 0;
+    }
+
+    /*
+    Starts of a publisher on this memory, including this one.
+    */
+    uint32_t generation() const {
+      return _header ? _header->generation / 2 : 0;
+    }
+
+  private:
+    BusFrame _frame{};
+
+    static bool _isRequest(const RequestParser *){
+      return true;
+    }
+
+    static bool _isRequest(const ResponseParser *){
+      return false;
+    }
+};
+
+class FrameBusSubscriber: public FrameBus{
+  public:
+    FrameBusSubscriber(){};
+    FrameBusSubscriber(const FrameBusSubscriber&) = delete;
+    FrameBusSubscriber& operator= (const FrameBusSubscriber&) = delete;
+
+    /*
+    Attaches to a ring formatted by a publisher.
+    The subscriber starts with the next published frame.
+    Returns false if memory holds no ring of this version.
+    */
+    bool attach(uint8_t *memory, size_t size){
+      Header *header = reinterpret_cast<Header*>(memory);
+      if (size < sizeof(Header) || _load(&header->magic) != MBFRAMEBUS_MAGIC || header->slotSize != sizeof(Slot)
+          || header->slots < 2 || size < memorySize(header->slots) || (_load(&header->generation) & 1)){
+        return false;
+      }
+      _header = header;
+      _slots = reinterpret_cast<Slot*>(memory + sizeof(Header));
+      _size = size;
+      _generation = _load(&_header->generation);
+      _next = _load(&_header->head);
+      return true;
+    }
+
+    /*
+    Copies the next frame into frame.
+    */
+    BusReadStatus read(BusFrame &frame){
+      const BusFrame *slot = nullptr;
+      BusReadStatus status = peek(slot);
+      if (status != BusReadStatus::frame){
+        return status;
+      }
+      memcpy(&frame, slot, sizeof(BusFrame) - MBFRAMEBUS_PAYLOAD + min(slot->byteCount, MBFRAMEBUS_PAYLOAD));
+      return release() ? BusReadStatus::frame : BusReadStatus::overrun;
+    }
+
+    /*
+    Points frame to the next frame in shared memory without copy.
+    Call release when done. Only if release returns true, the frame was not
+    overwritten in the meantime and its content is valid.
+    */
+    BusReadStatus peek(const BusFrame *&frame){
+      uint32_t generation = _load(&_header->generation);
+      if (generation != _generation){
+        return _restart(generation);
+      }
+      uint32_t head = _load(&_header->head);
+      if (head == _next){
+        return BusReadStatus::empty;
+      }
+      if (head - _next > _header->slots){
+        _overrun();
+        return BusReadStatus::overrun;
+      }
+      const Slot &slot = _slots[_next % _header->slots];
+      uint32_t sequence = _load(&slot.sequence);
+      if (sequence != 2 * _next + 2){
+        _overrun();
+        return BusReadStatus::overrun;
+      }
+      frame = &slot.frame;
+      _peeked = true;
+      return BusReadStatus::frame;
+    }
+
+    bool release(){
+      if (!_peeked){
+        return false;
+      }
+      _peeked = false;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      const Slot &slot = _slots[_next % _header->slots];
+      if (_load(&slot.sequence) != 2 * _next + 2 || _load(&_header->generation) != _generation){
+        _overrun();
+        return false;
+      }
+      _next++;
+      _received++;
+      return true;
+    }
+
+    // ---GETTERS---
+
+    /*
+    Frames published but not yet read.
+    */
+    uint32_t available() const {
+      return _load(&_header->head) - _next;
+    }
+
+    uint32_t received() const {
+      return _received;
+    }
+
+    uint32_t lost() const {
+      return _lost;
+    }
+
+    /*
+    Publisher restarts seen since attach.
+    */
+    uint32_t restarts() const {
+      return _restarts;
+    }
+
+  private:
+    size_t _size{0};
+    uint32_t _generation{0};
+    uint32_t _next{0};
+    bool _peeked{false};
+    uint32_t _received{0};
+    uint32_t _lost{0};
+    uint32_t _restarts{0};
+
+    /*
+    Continues with the first frame of a restarted publisher, an overrun is detected by the next peek.
+    Waits while the ring is formatted or does not fit into the attached memory.
+    */
+    BusReadStatus _restart(uint32_t generation){
+      _peeked = false;
+      if ((generation & 1) || _header->slots < 2 || _size < memorySize(_header->slots)){
+        return BusReadStatus::empty;
+      }
+      _next = 0;
+      _generation = generation;
+      _restarts++;
+      return BusReadStatus::restarted;
+    }
+
+    /*
+    Continues with the oldest frame, which is not overwritten by the next publish.
+    After a restart of the publisher the next peek resyncs instead.
+    */
+    void _overrun(){
+      _peeked = false;
+      if (_load(&_header->generation) != _generation){
+        return;
+      }
+      uint32_t head = _load(&_header->head);
+      uint32_t oldest = head - _header->slots + 1;
+      if (int32_t(oldest - _next) > 0){
+        _lost += oldest - _next;
+        _next = oldest;
+      } else {
+        // torn read, the frame is gone
+        _lost++;
+        _next++;
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,581 @@
+/*
+mbgateway.h
+
+Contains:
+Definition of ModbusGateway, a modbus TCP to RTU gateway.
+Type safe enum for the submit status.
+
+Remarks:
+The gateway does not own any socket or serial port. Transport is done by the user
+via writer callbacks and by feeding received bytes. This keeps the gateway usable on
+embedded targets as well as on hosts with sockets and ptys.
+
+Each RTU bus has its own request queue. Requests are scheduled round robin over the
+clients, so one busy client cannot starve the others. The next request is written to
+the bus from within the response callback, so the line does not idle between
+transactions.
+
+A broadcast (unit id 0) is not answered. The bus idles for the turnaround delay,
+then the next request is dispatched. A frame with an error fails the active request
+only if it is of the requested slave and function code, other frames are skipped.
+
+With a ReadCache set, fresh reads are answered from the cache without a bus transaction.
+Identical reads of several clients which are queued or on the bus at the same time
+share one transaction (single flight), the response is send to each of them.
+A read overlapping a queued or active write of the same slave and table is neither answered
+from the cache nor shared, so it returns the written value.
+
+Queue sizes are fixed at compile time and can be changed with
+-D MBGATEWAY_BUSES=n and -D MBGATEWAY_QUEUE_DEPTH=n
+*/
+#ifndef mbgateway_h
+#define mbgateway_h
+
+#include "mbparser.h"
+#include "mbframe.h"
+#include "mbcache.h"
+
+#ifndef MBGATEWAY_BUSES
+#define MBGATEWAY_BUSES 2
+#endif
+
+#ifndef MBGATEWAY_QUEUE_DEPTH
+#define MBGATEWAY_QUEUE_DEPTH 8
+#endif
+
+#define MBGATEWAY_NO_ROUTE 0xFF
+
+class ModbusGateway;
+
+#ifdef STD_FUNCTIONAL
+  typedef std::function<void(ModbusGateway *gateway, uint8_t bus, const uint8_t *frame, uint16_t len)> GatewayBusWriter;
+  typedef std::function<void(ModbusGateway *gateway, uint8_t client, const uint8_t *adu, uint16_t len)> GatewayClientWriter;
+#else
+  typedef void(*GatewayBusWriter)(ModbusGateway *gateway, uint8_t bus, const uint8_t *frame, uint16_t len);
+  typedef void(*GatewayClientWriter)(ModbusGateway *gateway, uint8_t client, const uint8_t *adu, uint16_t len);
+#endif
+
+enum class GatewayStatus{
+  accepted = 0,
+  invalidFrame = 1,
+  illegalFunction = 2,
+  noRoute = 3,
+  queueFull = 4,
+  clientLimit = 5
+};
+
+/*
+The gateway accepts modbus TCP ADUs from any number of clients
+and forwards them to RTU buses. Responses are parsed by one ResponseParser per bus
+and send back to the originating client with its transaction id.
+
+Requests which cannot be queued are answered by the gateway with a modbus exception.
+*/
+class ModbusGateway{
+  public:
+    ModbusGateway(){
+      for (uint8_t idx = 0; idx < MBGATEWAY_BUSES; idx++){
+        _buses[idx].gateway = this;
+        _buses[idx].index = idx;
+        _buses[idx].parser.setExtension(&_buses[idx]);
+        _buses[idx].parser.setByteCountLimit(MB_MAX_PDU - 2);
+        _buses[idx].parser.setOnCompleteCB(_onComplete);
+        _buses[idx].parser.setOnErrorCB(_onError);
+      }
+      for (uint16_t unit = 0; unit < 256; unit++){
+        _routes[unit] = 0;
+      }
+    };
+    ModbusGateway(const ModbusGateway&) = delete;
+    ModbusGateway& operator= (const ModbusGateway&) = delete;
+
+    /*
+    Sets writer to send a RTU frame on a bus.
+    */
+    void setBusWriter(GatewayBusWriter cb){
+      _busWriter = cb;
+    }
+
+    /*
+    Sets writer to send a TCP ADU to a client.
+    */
+    void setClientWriter(GatewayClientWriter cb){
+      _clientWriter = cb;
+    }
+
+    /*
+    Routes a unit id to a bus.
+    Use MBGATEWAY_NO_ROUTE to block a unit.
+    By default all units are routed to bus 0.
+    */
+    void setRoute(uint8_t unitId, uint8_t bus){
+      _routes[unitId] = bus < MBGATEWAY_BUSES ? bus : MBGATEWAY_NO_ROUTE;
+    }
+
+    /*
+    Sets the maximum of queued requests per client and bus.
+    Default is the queue depth, i.e. no limit.
+    */
+    void setClientLimit(uint8_t limit){
+      _clientLimit = limit;
+    }
+
+    /*
+    Sets the time a bus waits for a response.
+    Default is 100 ms.
+    */
+    void setTimeout(unsigned long timeout){
+      _timeout = timeout;
+    }
+
+    /*
+    Sets the time a bus stays idle after a broadcast (unit id 0),
+    so the slaves can process it. Broadcasts are not answered.
+    Default is 100 ms.
+    */
+    void setTurnaround(unsigned long turnaround){
+      _turnaround = turnaround;
+    }
+
+    /*
+    Sets a read cache and enables coalescing of identical reads.
+    Completed reads are stored, writes invalidate overlapping cached reads.
+    Use nullptr to disable.
+    */
+    void setCache(ReadCache *cache){
+      _cache = cache;
+    }
+
+    /*
+    Sets void pointer to keep reference to third party objects.
+    */
+    void setExtension(void* ptr){
+      _extension = ptr;
+    }
+
+    void* getExtension(){
+      return _extension;
+    }
+
+    /*
+    Queues a TCP ADU of a client.
+    The request is written to the bus immediately if the bus is idle.
+    If the request is rejected, an exception response is send to the client.
+    */
+    GatewayStatus submit(uint8_t client, const uint8_t *adu, uint16_t len, unsigned long now){
+      _now = now;
+      MBAPHeader header;
+      if (!ModbusFrame::readMBAP(adu, len, header) || len != header.length + 6){
+        return GatewayStatus::invalidFrame;
+      }
+      uint8_t fc = adu[MB_MBAP_SIZE];
+      if (!_isSupported(fc)){
+        _replyException(client, header.transactionId, header.unitId, fc, ErrorCode::illegalFunction);
+        return GatewayStatus::illegalFunction;
+      }
+      uint8_t busIndex = _routes[header.unitId];
+      if (busIndex == MBGATEWAY_NO_ROUTE){
+        _replyException(client, header.transactionId, header.unitId, fc, ErrorCode::gatewayPathUnavailable);
+        return GatewayStatus::noRoute;
+      }
+      Bus &bus = _buses[busIndex];
+      if (_replyCached(bus, client, adu, len, header)){
+        return GatewayStatus::accepted;
+      }
+      int8_t freeSlot = -1;
+      uint8_t perClient = 0;
+      for (uint8_t idx = 0; idx < MBGATEWAY_QUEUE_DEPTH; idx++){
+        if (!bus.slots[idx].used){
+          freeSlot = freeSlot < 0 ? idx : freeSlot;
+        } else if (bus.slots[idx].client == client && !bus.slots[idx].orphan){
+          perClient++;
+        }
+      }
+      if (freeSlot < 0){
+        _replyException(client, header.transactionId, header.unitId, fc, ErrorCode::slaveDeviceBusy);
+        return GatewayStatus::queueFull;
+      }
+      if (perClient >= _clientLimit){
+        _replyException(client, header.transactionId, header.unitId, fc, ErrorCode::slaveDeviceBusy);
+        return GatewayStatus::clientLimit;
+      }
+
+      Slot &slot = bus.slots[freeSlot];
+      slot.used = true;
+      slot.orphan = false;
+      slot.client = client;
+      slot.transactionId = header.transactionId;
+      slot.unitId = header.unitId;
+      slot.functionCode = fc;
+      slot.sequence = _sequence++;
+      slot.len = ModbusFrame::tcpToRTU(slot.frame, adu, len);
+      slot.leader = _findLeader(bus, slot);
+      if (slot.leader >= 0){
+        _coalesced++;
+        return GatewayStatus::accepted;
+      }
+      _dispatch(bus);
+      return GatewayStatus::accepted;
+    }
+
+    /*
+    Parses bytes received on a bus.
+    Returns the state of the bus parser.
+    */
+    ParserState parse(uint8_t bus, uint8_t *buffer, uint16_t len, unsigned long now){
+      _now = now;
+      return _buses[bus].parser.parse(buffer, len);
+    }
+
+    /*
+    Checks pending transactions for timeouts.
+    A timed out transaction is answered with a gateway exception
+    and the next request is dispatched.
+    A broadcast is completed without reply once the turnaround delay has passed.
+    */
+    void poll(unsigned long now){
+      _now = now;
+      for (uint8_t idx = 0; idx < MBGATEWAY_BUSES; idx++){
+        Bus &bus = _buses[idx];
+        if (bus.active < 0){
+          continue;
+        }
+        bool isBroadcast = bus.slots[bus.active].unitId == 0;
+        if (_now - bus.sentAt < (isBroadcast ? _turnaround : _timeout)){
+          continue;
+        }
+        if (!isBroadcast){
+          _replyException(bus, ErrorCode::gatewayTargetFailed);
+        }
+        bus.parser.reset();
+        _finish(bus);
+      }
+    }
+
+    /*
+    Removes all requests of a disconnected client.
+    A request which is already on the bus is completed, but not answered.
+    A queued request shared with other clients is handed over to one of them.
+    */
+    void dropClient(uint8_t client){
+      for (uint8_t b = 0; b < MBGATEWAY_BUSES; b++){
+        Bus &bus = _buses[b];
+        for (uint8_t idx = 0; idx < MBGATEWAY_QUEUE_DEPTH; idx++){
+          Slot &slot = bus.slots[idx];
+          if (!slot.used || slot.client != client){
+            continue;
+          }
+          if (idx == bus.active){
+            slot.orphan = true;
+          } else {
+            slot.used = false;
+            _handOver(bus, idx);
+          }
+        }
+      }
+    }
+
+    // ---GETTERS---
+
+    uint8_t queued(uint8_t bus) const {
+      uint8_t count = 0;
+      for (uint8_t idx = 0; idx < MBGATEWAY_QUEUE_DEPTH; idx++){
+        count += _buses[bus].slots[idx].used;
+      }
+      return count;
+    }
+
+    bool isBusy(uint8_t bus) const {
+      return _buses[bus].active >= 0;
+    }
+
+    ResponseParser& parser(uint8_t bus){
+      return _buses[bus].parser;
+    }
+
+    /*
+    Requests which shared the transaction of an identical request.
+    */
+    uint32_t coalesced() const {
+      return _coalesced;
+    }
+
+  private:
+    struct Slot{
+      bool used{false};
+      bool orphan{false};
+      uint8_t client{0};
+      uint16_t transactionId{0};
+      uint8_t unitId{0};
+      uint8_t functionCode{0};
+      int8_t leader{-1}; // slot whose transaction is shared
+      uint32_t sequence{0};
+      uint16_t len{0};
+      uint8_t frame[MB_RTU_MAX_ADU];
+    };
+
+    struct Bus{
+      ModbusGateway *gateway{nullptr};
+      uint8_t index{0};
+      ResponseParser parser{};
+      Slot slots[MBGATEWAY_QUEUE_DEPTH];
+      int8_t active{-1};
+      uint8_t lastClient{255};
+      unsigned long sentAt{0};
+    };
+
+    Bus _buses[MBGATEWAY_BUSES];
+    uint8_t _routes[256];
+
+    GatewayBusWriter _busWriter{nullptr};
+    GatewayClientWriter _clientWriter{nullptr};
+
+    uint8_t _clientLimit{MBGATEWAY_QUEUE_DEPTH};
+    unsigned long _timeout{100};
+    unsigned long _turnaround{100};
+    unsigned long _now{0};
+    uint32_t _sequence{0};
+
+    ReadCache *_cache{nullptr};
+    uint32_t _coalesced{0};
+
+    void* _extension{nullptr};
+
+    static void _onComplete(ResponseParser *parser){
+      Bus *bus = static_cast<Bus*>(parser->getExtension());
+      bus->gateway->_complete(*bus);
+    }
+
+    static void _onError(ResponseParser *parser){
+      Bus *bus = static_cast<Bus*>(parser->getExtension());
+      bus->gateway->_fail(*bus);
+    }
+
+    bool _isSupported(uint8_t fc) const {
+      return (fc >= 0x01 && fc <= 0x06) || fc == 0x0F || fc == 0x10;
+    }
+
+    /*
+    Picks the next request of the bus.
+    The client following the last served client wins, within a client the oldest request.
+    */
+    int8_t _schedule(const Bus &bus) const {
+      int8_t best = -1;
+      uint8_t bestDistance = 0;
+      uint32_t bestSequence = 0;
+      for (uint8_t idx = 0; idx < MBGATEWAY_QUEUE_DEPTH; idx++){
+        const Slot &slot = bus.slots[idx];
+        if (!slot.used || slot.leader >= 0){
+          continue;
+        }
+        uint8_t distance = uint8_t(slot.client - bus.lastClient - 1);
+        if (best < 0 || distance < bestDistance || (distance == bestDistance && slot.sequence < bestSequence)){
+          best = idx;
+          bestDistance = distance;
+          bestSequence = slot.sequence;
+        }
+      }
+      return best;
+    }
+
+    void _dispatch(Bus &bus){
+      while (bus.active < 0){
+        int8_t next = _schedule(bus);
+        if (next < 0){
+          return;
+        }
+        Slot &slot = bus.slots[next];
+        bus.active = next;
+        bus.lastClient = slot.client;
+        bus.sentAt = _now;
+        bus.parser.reset();
+        bus.parser.setSlaveAddress(slot.unitId);
+        if (_busWriter){
+          _busWriter(this, bus.index, slot.frame, slot.len);
+        }
+      }
+    }
+
+    void _finish(Bus &bus){
+      Slot &active = bus.slots[bus.active];
+      if (_cache && _isWrite(active.functionCode)){
+        _cache->invalidate(active.unitId, active.functionCode, _address(active), _quantity(active));
+      }
+      for (uint8_t idx = 0; idx < MBGATEWAY_QUEUE_DEPTH; idx++){
+        Slot &slot = bus.slots[idx];
+        if (slot.used && slot.leader == bus.active){
+          slot.used = false;
+          slot.leader = -1;
+        }
+      }
+      active.used = false;
+      bus.active = -1;
+      _dispatch(bus);
+    }
+
+    void _complete(Bus &bus){
+      if (bus.active < 0){
+        return;
+      }
+      Slot &slot = bus.slots[bus.active];
+      if (slot.unitId == 0 || bus.parser.functionCode() != slot.functionCode){
+        // not the answer to our request, keep waiting
+        return;
+      }
+      if (_cache && !_isWrite(slot.functionCode)){
+        _cache->store(slot.unitId, slot.functionCode, _address(slot), _quantity(slot), bus.parser, _now);
+      }
+      uint8_t adu[MB_TCP_MAX_ADU];
+      uint16_t pduLength = ModbusFrame::responsePDU(adu + MB_MBAP_SIZE, bus.parser);
+      _reply(bus, adu, pduLength);
+      _finish(bus);
+    }
+
+    void _fail(Bus &bus){
+      if (bus.active < 0){
+        return;
+      }
+      const Slot &slot = bus.slots[bus.active];
+      if (slot.unitId == 0 || bus.parser.slaveAddress() != slot.unitId
+          || bus.parser.functionCode() != slot.functionCode){
+        // noise or a frame of another slave, keep waiting for the answer
+        bus.parser.reset();
+        return;
+      }
+      ErrorCode code = bus.parser.errorCode();
+      if (code == ErrorCode::CRCError || code == ErrorCode::noError){
+        code = ErrorCode::gatewayTargetFailed;
+      }
+      _replyException(bus, code);
+      _finish(bus);
+    }
+
+    /*
+    Sends the response PDU in adu to the client of the active request
+    and to all clients sharing its transaction.
+    */
+    void _reply(Bus &bus, uint8_t *adu, uint16_t pduLength){
+      for (uint8_t idx = 0; idx < MBGATEWAY_QUEUE_DEPTH; idx++){
+        const Slot &slot = bus.slots[idx];
+        if (!slot.used || slot.orphan || (idx != bus.active && slot.leader != bus.active)){
+          continue;
+        }
+        ModbusFrame::mbap(adu, slot.transactionId, slot.unitId, pduLength);
+        _writeClient(slot.client, adu, MB_MBAP_SIZE + pduLength);
+      }
+    }
+
+    void _replyException(Bus &bus, ErrorCode code){
+      uint8_t adu[MB_MBAP_SIZE + 2];
+      adu[MB_MBAP_SIZE] = bus.slots[bus.active].functionCode | 0x80;
+      adu[MB_MBAP_SIZE + 1] = static_cast<uint8_t>(code);
+      _reply(bus, adu, 2);
+    }
+
+    /*
+    Answers a read from the cache.
+    */
+    bool _replyCached(const Bus &bus, uint8_t client, const uint8_t *adu, uint16_t len, const MBAPHeader &header){
+      uint8_t fc = adu[MB_MBAP_SIZE];
+      if (!_cache || _isWrite(fc) || header.unitId == 0 || len != MB_MBAP_SIZE + 5){
+        return false;
+      }
+      uint16_t address = ModbusFrame::getWord(adu + MB_MBAP_SIZE + 1);
+      uint16_t quantity = ModbusFrame::getWord(adu + MB_MBAP_SIZE + 3);
+      if (_isWritePending(bus, header.unitId, fc, address, quantity)){
+        return false;
+      }
+      uint8_t response[MB_TCP_MAX_ADU];
+      uint16_t pduLength = _cache->responsePDU(response + MB_MBAP_SIZE, header.unitId, fc, address, quantity, _now);
+      if (pduLength == 0){
+        return false;
+      }
+      ModbusFrame::mbap(response, header.transactionId, header.unitId, pduLength);
+      _writeClient(client, response, MB_MBAP_SIZE + pduLength);
+      return true;
+    }
+
+    /*
+    Returns the queued or active read identical to slot, which slot can share.
+    */
+    int8_t _findLeader(const Bus &bus, const Slot &slot) const {
+      if (!_cache || _isWrite(slot.functionCode) || slot.unitId == 0
+          || _isWritePending(bus, slot.unitId, slot.functionCode, _address(slot), _quantity(slot))){
+        return -1;
+      }
+      for (uint8_t idx = 0; idx < MBGATEWAY_QUEUE_DEPTH; idx++){
+        const Slot &other = bus.slots[idx];
+        if (&other != &slot && other.used && other.leader < 0 && other.len == slot.len
+            && memcmp(other.frame, slot.frame, slot.len) == 0){
+          return idx;
+        }
+      }
+      return -1;
+    }
+
+    /*
+    Makes the first client sharing the transaction of a dropped queued request the new leader.
+    */
+    void _handOver(Bus &bus, int8_t dropped){
+      int8_t leader = -1;
+      for (uint8_t idx = 0; idx < MBGATEWAY_QUEUE_DEPTH; idx++){
+        Slot &slot = bus.slots[idx];
+        if (!slot.used || slot.leader != dropped){
+          continue;
+        }
+        if (leader < 0){
+          leader = idx;
+          slot.leader = -1;
+        } else {
+          slot.leader = leader;
+        }
+      }
+    }
+
+    bool _isWrite(uint8_t fc) const {
+      return fc > 0x04;
+    }
+
+    /*
+    Returns true if a write of slave to the table of read fc overlapping the read is queued or active.
+    FC05 and FC15 write coils (FC01), FC06 and FC16 holding registers (FC03).
+    */
+    bool _isWritePending(const Bus &bus, uint8_t unitId, uint8_t fc, uint16_t address, uint16_t quantity) const {
+      for (uint8_t idx = 0; idx < MBGATEWAY_QUEUE_DEPTH; idx++){
+        const Slot &slot = bus.slots[idx];
+        if (!slot.used || !_isWrite(slot.functionCode) || slot.unitId != unitId){
+          continue;
+        }
+        uint8_t table = slot.functionCode == 0x05 || slot.functionCode == 0x0F ? 0x01 : 0x03;
+        uint16_t start = _address(slot);
+        if (table == fc && start < uint32_t(address) + quantity && address < uint32_t(start) + _quantity(slot)){
+          return true;
+        }
+      }
+      return false;
+    }
+
+    uint16_t _address(const Slot &slot) const {
+      return ModbusFrame::getWord(slot.frame + 2);
+    }
+
+    uint16_t _quantity(const Slot &slot) const {
+      return slot.functionCode == 0x05 || slot.functionCode == 0x06 ? 1 : ModbusFrame::getWord(slot.frame + 4);
+    }
+
+    void _replyException(uint8_t client, uint16_t transactionId, uint8_t unitId, uint8_t fc, ErrorCode code){
+      uint8_t adu[MB_MBAP_SIZE + 2];
+      uint16_t len = ModbusFrame::mbap(adu, transactionId, unitId, 2);
+      adu[len++] = fc | 0x80;
+      adu[len++] = static_cast<uint8_t>(code);
+      _writeClient(client, adu, len);
+    }
+
+    void _writeClient(uint8_t client, const uint8_t *adu, uint16_t len){
+      if (_clientWriter){
+        _clientWriter(this, client, adu, len);
+      }
+    }
+};
+
+#endif
@@ -33,19 +33,23 @@ However, it was original implemented for little endian machines.
 class ResponseParser;
 class RequestParser;
 
-template<typename CB, typename TChild>
-class ModbusParser;
-
 // Function Pointers
 #ifdef STD_FUNCTIONAL
   #include <functional>
   typedef std::function<void(ResponseParser *parser)> ResponseCallback;
   typedef std::function<void(RequestParser *parser)> RequestCallback;
+  typedef std::function<void(ResponseParser *parser, const uint8_t *data, uint16_t len, uint16_t offset)> ResponseDataCallback;
+  typedef std::function<void(RequestParser *parser, const uint8_t *data, uint16_t len, uint16_t offset)> RequestDataCallback;
 #else
   typedef void(*ResponseCallback)(ResponseParser *parser);
   typedef void(*RequestCallback)(RequestParser *parser);
+  typedef void(*ResponseDataCallback)(ResponseParser *parser, const uint8_t *data, uint16_t len, uint16_t offset);
+  typedef void(*RequestDataCallback)(RequestParser *parser, const uint8_t *data, uint16_t len, uint16_t offset);
 #endif
 
+template<typename CB, typename TChild, typename DCB = void(*)(TChild *parser, const uint8_t *data, uint16_t len, uint16_t offset)>
+class ModbusParser;
+
 // General used enums
 
 enum class ParserState{
@@ -59,7 +63,8 @@ enum class ParserState{
     firstCRC = 7,
     secondCRC = 8,
     complete = 9,
-    modbusException = 10
+    modbusException = 10,
+    exception = 11 // complete exception response
 };
 
 enum class ErrorCode{
@@ -72,11 +77,65 @@ enum class ErrorCode{
     acknowledge = 5,
     slaveDeviceBusy = 6,
     memoryParityError = 8,
+    gatewayPathUnavailable = 10,
+    gatewayTargetFailed = 11,
     // mbParser Exception
     CRCError = 21
 };
 
 
+/*
+Summary of one parsed frame, passed to a FrameObserver.
+states has bit n set for each ParserState n the frame passed through,
+it is zero unless state tracking is enabled with setObserver.
+consumed counts all bytes since the end of the previous frame.
+*/
+struct FrameSummary{
+  unsigned long start;
+  uint8_t source;
+  uint8_t slave;
+  uint8_t functionCode;
+  ParserState state; // complete, exception or error
+  ErrorCode errorCode;
+  uint16_t states;
+  uint16_t byteCount;
+  uint16_t consumed;
+};
+
+/*
+Observes the frames of a parser, e.g. FrameTracer of mbtrace.h.
+*/
+class FrameObserver{
+  public:
+    virtual ~FrameObserver(){};
+    /*
+    Called with the first byte of a frame.
+    Returns the start time of the frame, which is passed back in the summary.
+    */
+    virtual unsigned long onFrameStart() = 0;
+    /*
+    Called when a frame ends, before the callbacks of the parser.
+    */
+    virtual void onFrame(const FrameSummary &frame) = 0;
+};
+
+/*
+Renders one token into the modbus RTU CRC16.
+Start value of a frame is 0xFFFF.
+The CRC is transmitted low byte first.
+*/
+inline uint16_t modbusCRC(uint16_t crc, uint8_t token){
+  crc ^= (uint16_t)token;  // XOR byte into least sig. byte of crc
+  for (int i = 8; i != 0; i--) { // Loop over each bit
+    if ((crc & 0x0001) != 0) {  // If the LSB is set
+      crc >>= 1;                // Shift right and XOR 0xA001
+      crc ^= 0xA001;
+    } else        // Else LSB is not set
+      crc >>= 1; // Just shift right
+  }
+  return crc;
+}
+
 /*
 ModbusParser Base class implements the general part of a modbus frame
 and provides infrastructure for its child classes, like memory handling.
@@ -93,10 +152,12 @@ The parser implements BIG ENDIAN format modbus frames.
 User can swap to LITTLE ENDIAN. This makes it possible to parse
 LITTLE_ENDIAN and BIG_ENDIAN subscribers.
 */
-template<typename CB, typename TChild>
+template<typename CB, typename TChild, typename DCB>
 class ModbusParser{
   public:
-    virtual ~ModbusParser() = default;
+    virtual ~ModbusParser(){
+      clearSlaveTable();
+    };
     ModbusParser(const ModbusParser&) = delete;
     ModbusParser& operator= (const ModbusParser&) = delete;
    
@@ -112,8 +173,13 @@ class ModbusParser{
 
       // consume all provided tokens
       while (index < len && _nextState != ParserState::error) {
-        _parse(buffer[index]);
-        index++;
+        if (_nextState == ParserState::data && _onData){
+          // payload is delivered directly from buffer
+          index += _streamData(buffer + index, len - index);
+        } else {
+          _parse(buffer[index]);
+          index++;
+        }
       }
       return _nextState;
     }
@@ -152,18 +218,57 @@ class ModbusParser{
       _onError=cb;
     };
 
+    /*
+    Sets on exception callback.
+    Is called when parser has finished one exception response with valid CRC.
+    functionCode is the function code of the request, errorCode the exception code.
+    Without exception callback the error callback is called.
+    */
+    void setOnExceptionCB(CB cb){
+      _onException = cb;
+    };
+
+    /*
+    Sets on data callback and enables streaming mode.
+    The payload is not buffered but delivered in chunks as it arrives:
+    data points to len payload bytes, offset is the position of the first byte within the payload.
+    When parse is called with a buffer, chunks point into that buffer.
+    The chunks are unverified until the frame ends: the complete callback commits them,
+    the error callback (e.g. CRC error) rolls them back.
+    In streaming mode data() is nullptr, setSwap and the byte count limit are ignored.
+    Helpers which read the payload of a complete parser, e.g. ModbusFrame::responsePDU,
+    return zero or false then, FrameBusPublisher publishes frames without payload.
+    nullptr disables streaming mode.
+    */
+    void setOnDataCB(DCB cb){
+      _onData = cb;
+    };
+
+    /*
+    Sets an observer which is told about the start and end of each frame.
+    source is passed in the summary to tell parsers apart.
+    trackStates records the states each frame passed through, at the cost of one more
+    branch and OR per byte.
+    nullptr removes the observer.
+    */
+    void setObserver(FrameObserver *observer, uint8_t source = 0, bool trackStates = false){
+      _observer = observer;
+      _source = source;
+      _trackStates = trackStates;
+    }
+
     /*
     Swaps byte order of data frames
     */
     void setSwap(bool swap){
-      _reverse = swap;
+      _config.reverse = swap;
     };
     
     /*
     To swap each register the size of register needs to be set
     */
     void setRegisterSize(uint16_t size){
-      _registerSize=size;
+      _config.registerSize = size;
     };
 
     
@@ -198,7 +303,61 @@ class ModbusParser{
     The default limit is 96 bytes. 
     */
     void setByteCountLimit(size_t size){
-      _byteCountLimit = size;
+      _config.byteCountLimit = size;
+    }
+
+    /*
+    Demultiplexer mode.
+    The first call of a setSlaveXXX function creates a table of 256 slaves on heap.
+    Each entry starts with the current parser settings and disabled.
+    Then the slave address byte selects the entry, which is used until the frame ends.
+    Frames of disabled slaves are skipped like frames of foreign slaves.
+    setSlaveAddress has no effect in this mode.
+    */
+
+    /*
+    Enables or disables frames of slave.
+    */
+    void setSlaveEnabled(uint8_t slave, bool enabled){
+      _slaveTable()[slave].enabled = enabled;
+    }
+
+    /*
+    Enables slave and sets its callbacks.
+    nullptr falls back to the callbacks of the parser.
+    */
+    void setSlaveHandler(uint8_t slave, CB onComplete, CB onError = nullptr){
+      SlaveConfig &config = _slaveTable()[slave];
+      config.enabled = true;
+      config.onComplete = onComplete;
+      config.onError = onError;
+    }
+
+    /*
+    Sets byte count limit of slave.
+    */
+    void setSlaveByteCountLimit(uint8_t slave, size_t size){
+      _slaveTable()[slave].byteCountLimit = size;
+    }
+
+    /*
+    Sets byte order of slave, see setSwap and setRegisterSize.
+    */
+    void setSlaveSwap(uint8_t slave, bool swap, uint16_t registerSize){
+      SlaveConfig &config = _slaveTable()[slave];
+      config.reverse = swap;
+      config.registerSize = registerSize;
+    }
+
+    /*
+    Leaves demultiplexer mode and frees the slave table.
+    */
+    void clearSlaveTable(){
+      if (_slaves != nullptr){
+        delete[] _slaves;
+        _slaves = nullptr;
+      }
+      _active = &_config;
     }
 
     // ---GETTERS---
@@ -252,17 +411,36 @@ class ModbusParser{
     }
 
     size_t byteCountLimit() const {
-      return _byteCountLimit;
+      return _config.byteCountLimit;
+    }
+
+    bool isSlaveEnabled(uint8_t slave) const {
+      return _slaves != nullptr ? _slaves[slave].enabled : (_mySlaveAddress == 0 || _mySlaveAddress == slave);
     }
 
     bool isComplete() const {
       return _nextState == ParserState::complete;
     }
 
+    /*
+    True for a broken frame and, as before exception responses got their own
+    state, for a complete exception response. isException() tells them apart.
+    */
     bool isError() const {
-      return _nextState == ParserState::error;
+      return _nextState == ParserState::error || _nextState == ParserState::exception;
     } 
 
+    /*
+    True for a complete exception response with valid CRC. isError() is true as well.
+    */
+    bool isException() const {
+      return _nextState == ParserState::exception;
+    }
+
+    bool isStreaming() const {
+      return _onData != nullptr;
+    }
+
     /*
     Frees the heap located data array.
     Can be called by user.
@@ -282,6 +460,18 @@ class ModbusParser{
     virtual const ParserState* dispatch10() = 0;
 
   private:
+    /*
+    Settings which apply to one frame.
+    */
+    struct SlaveConfig{
+      bool enabled{false};
+      bool reverse{false};
+      uint16_t registerSize{};
+      size_t byteCountLimit{96};
+      CB onComplete{nullptr};
+      CB onError{nullptr};
+    };
+
     const uint16_t _supportedFunctionCodes[8] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x0F, 0x10};
     const ParserState* _dispatchFC{nullptr};
 
@@ -293,6 +483,16 @@ class ModbusParser{
     
     CB _onComplete {nullptr};
     CB _onError {nullptr};
+    CB _onException {nullptr};
+    DCB _onData {nullptr};
+    uint16_t _streamOffset{0};
+
+    FrameObserver *_observer{nullptr};
+    uint8_t _source{0};
+    bool _trackStates{false};
+    unsigned long _frameStart{0};
+    uint16_t _states{0};
+    uint16_t _consumed{0};
     
     uint8_t _token{};
     
@@ -300,6 +500,7 @@ class ModbusParser{
     ParserState _nextState{ParserState::slaveAddress};
     
     ErrorCode _errorCode{ErrorCode::noError};
+    bool _isException{false}; // frame is an exception response
     
     uint8_t _slaveAddress{250}; // invalid
     uint8_t _mySlaveAddress{0};
@@ -313,12 +514,25 @@ class ModbusParser{
     uint16_t _crc{0xFFFF};
 
     uint16_t _endianness{BIG_ENDIAN};
-    bool _reverse {false};
-    uint16_t _registerSize{};
     uint16_t _swappedBytes{};
 
+    SlaveConfig _config{};
+    SlaveConfig *_slaves{nullptr};
+    const SlaveConfig *_active{&_config};
+
     void* _extension{nullptr};
-    size_t _byteCountLimit{96};
+
+    SlaveConfig* _slaveTable(){
+      if (_slaves == nullptr){
+        _slaves = new SlaveConfig[256];
+        for (uint16_t slave = 0; slave < 256; slave++){
+          _slaves[slave].reverse = _config.reverse;
+          _slaves[slave].registerSize = _config.registerSize;
+          _slaves[slave].byteCountLimit = _config.byteCountLimit;
+        }
+      }
+      return _slaves;
+    }
 
     /*
     Actual implementation of parse.
@@ -328,10 +542,14 @@ class ModbusParser{
       _token = token;
       // indeed currentState is laststate until the machine is rendered.
       _lastState = _nextState;
-      if (_nextState == ParserState::complete || _nextState == ParserState::error) {
+      if (_nextState == ParserState::complete || _nextState == ParserState::error
+          || _nextState == ParserState::exception) {
         _reset();
       }
       _renderStateMachine();
+      if (_observer){
+        _track();
+      }
       //Serial.printf("T: %2X, S: %d, D: %2d, E: %d, CRC: %X\n", token, static_cast<int>(_lastState),_dataToReceive ,static_cast<int>(errorCode()), _crc);
       _handleCallbacks();
     }
@@ -371,15 +589,29 @@ class ModbusParser{
     }
 
     void _handleCallbacks(){
+      if (_observer && (_nextState == ParserState::complete || _nextState == ParserState::exception
+          || _nextState == ParserState::error)){
+        _observe();
+      }
       switch (_nextState)
       {
       case ParserState::complete:
-        if (_onComplete){
+        if (_active->onComplete){
+          _active->onComplete(static_cast<TChild*>(this));
+        } else if (_onComplete){
           _onComplete(static_cast<TChild*>(this));
         }
         break;
+      case ParserState::exception:
+        if (_onException){
+          _onException(static_cast<TChild*>(this));
+          break;
+        }
+        // fall through
       case ParserState::error:
-        if (_onError) {
+        if (_active->onError){
+          _active->onError(static_cast<TChild*>(this));
+        } else if (_onError) {
           _onError(static_cast<TChild*>(this));
         }
         break;
@@ -388,6 +620,34 @@ class ModbusParser{
       }
     }
 
+    /*
+    Keeps the frame summary for the observer.
+    Per byte this is a counter increment, plus the state mask if enabled.
+    The observer is called on the first byte of a frame only.
+    */
+    void _track(){
+      if (_consumed++ == 0){
+        _frameStart = _observer->onFrameStart();
+      }
+      if (_trackStates){
+        _states |= 1 << static_cast<uint8_t>(_nextState);
+      }
+    }
+
+    void _observe(){
+      FrameSummary frame;
+      frame.start = _frameStart;
+      frame.source = _source;
+      frame.slave = _slaveAddress;
+      frame.functionCode = _functionCode;
+      frame.state = _nextState;
+      frame.errorCode = _errorCode;
+      frame.states = _states;
+      frame.byteCount = _byteCount;
+      frame.consumed = _consumed;
+      _observer->onFrame(frame);
+    }
+
     const ParserState* _getDispatchArray(){
       switch (_functionCode){
         case 0x01:
@@ -415,7 +675,17 @@ class ModbusParser{
     // --STATES--
 
     void _parseSlaveAddress() {
-      if (_token == _mySlaveAddress || _mySlaveAddress == 0) {
+      if (_slaves != nullptr){
+        _active = &_slaves[_token];
+        if (!_active->enabled){
+          _active = &_config;
+          _nextState = ParserState::slaveAddress;
+          return;
+        }
+        _slaveAddress = _token;
+        _nextState = ParserState::functionCode;
+        _renderCRC();
+      } else if (_token == _mySlaveAddress || _mySlaveAddress == 0) {
         _slaveAddress = _token;
         _nextState = ParserState::functionCode;
         _renderCRC();
@@ -426,7 +696,11 @@ class ModbusParser{
 
     void _checkFunctionCode() {
       if (_token > 128) {
+        // exception response, the frame ends with exception code and CRC
+        _functionCode = _token & 0x7F;
+        _isException = true;
         _nextState = ParserState::modbusException;
+        _renderCRC();
         return;
       }
       if (isFunctionCodeSupported(_token)) {
@@ -453,6 +727,9 @@ class ModbusParser{
     void _handleAddress(){
       // consumes 2 tokens
       _advanceDispatcher();
+      if (_nextState == ParserState::data){
+        _dataToReceive = 2; // write single has no byte count but 2 bytes
+      }
       _parseAddress();
       _renderCRC();
     }
@@ -492,7 +769,7 @@ class ModbusParser{
       
       if (_token > 0){
         _parseByteCount();
-        if (_byteCount > _byteCountLimit){
+        if (_byteCount > _active->byteCountLimit && !_onData){
           _nextState = ParserState::error;
           _errorCode = ErrorCode::illegalDataValue;
         }
@@ -514,12 +791,15 @@ class ModbusParser{
     }
 
     void _receiveData() {
+      if (_onData){
+        _deliverData(&_token, 1);
+        return;
+      }
       if (_dataArray == nullptr){
-        _dataToReceive = max(_dataToReceive, uint16_t(2)); // at least 2 bytes
         _allocateData(_dataToReceive);
       }
 
-      if (_reverse){
+      if (_active->reverse){
         _reverseCopyToken();
       } else {
         _copyToken();
@@ -530,6 +810,35 @@ class ModbusParser{
       }
     }
 
+    /*
+    Streams the payload part of buffer, including its CRC.
+    Returns the number of consumed bytes.
+    */
+    uint16_t _streamData(const uint8_t *buffer, uint16_t len){
+      uint16_t chunk = min(_dataToReceive, len);
+      for (uint16_t idx = 0; idx < chunk; idx++){
+        _crc = modbusCRC(_crc, buffer[idx]);
+      }
+      _lastState = ParserState::data;
+      _token = buffer[chunk - 1];
+      _consumed += chunk;
+      if (_trackStates){
+        _states |= 1 << static_cast<uint8_t>(ParserState::data);
+      }
+      _deliverData(buffer, chunk);
+      return chunk;
+    }
+
+    void _deliverData(const uint8_t *data, uint16_t len){
+      _dataToReceive -= len;
+      if (_dataToReceive == 0){
+        _nextState = ParserState::firstCRC;
+      }
+      uint16_t offset = _streamOffset;
+      _streamOffset += len;
+      _onData(static_cast<TChild*>(this), data, len, offset);
+    }
+
     void _copyToken(){
       *_dataPtr++ = _token;
     }
@@ -538,8 +847,8 @@ class ModbusParser{
       _swappedBytes--;
       *_dataPtr-- = _token;
       if (_swappedBytes <= 0){
-        _dataPtr += 2 * _registerSize;
-        _swappedBytes = _registerSize;
+        _dataPtr += 2 * _active->registerSize;
+        _swappedBytes = _active->registerSize;
       }
     }
 
@@ -557,7 +866,9 @@ class ModbusParser{
       uint8_t crcByte = _endianness == BIG_ENDIAN ? highByte(_crc) : lowByte(_crc);
       if (crcByte == _token) {
         // proof of concept.
-        if (!_dataToReceive){
+        if (_isException){
+          _nextState = ParserState::exception;
+        } else if (!_dataToReceive){
           _nextState = ParserState::complete;
         } else {
           // this would mean that implementation is wrong.
@@ -573,14 +884,15 @@ class ModbusParser{
 
     void _parseException(){
       _errorCode = static_cast<ErrorCode>(_token);
-      _nextState = ParserState::error;
+      _nextState = ParserState::firstCRC;
+      _renderCRC();
     }
 
     void _allocateData(size_t size) { 
       _dataArray = new uint8_t[size];
-      if (_reverse){
-        _dataPtr = _dataArray + _registerSize-1;
-        _swappedBytes = _registerSize;
+      if (_active->reverse){
+        _dataPtr = _dataArray + _active->registerSize-1;
+        _swappedBytes = _active->registerSize;
       } else {
         _dataPtr = _dataArray;
       } 
@@ -589,19 +901,19 @@ class ModbusParser{
     void _reset() {
       free();
       _crc = 0xFFFF;
+      _dataToReceive = 0;
+      _byteCount = 0;
+      _streamOffset = 0;
+      _states = 0;
+      _consumed = 0;
+      _functionCode = 0; // invalid
       _errorCode = ErrorCode::noError;
+      _isException = false;
       _nextState = ParserState::slaveAddress;
     }
 
     void _renderCRC() {
-      _crc ^= (uint16_t)_token;  // XOR byte into least sig. byte of crc
-      for (int i = 8; i != 0; i--) { // Loop over each bit
-        if ((_crc & 0x0001) != 0) {  // If the LSB is set
-          _crc >>= 1;                // Shift right and XOR 0xA001
-          _crc ^= 0xA001;
-        } else        // Else LSB is not set
-          _crc >>= 1; // Just shift right
-      }
+      _crc = modbusCRC(_crc, _token);
     }
 };
 
@@ -609,7 +921,7 @@ class ModbusParser{
 /*
 The response Parser is the core of the modbus master/client.
 */
-class ResponseParser: public ModbusParser<ResponseCallback, ResponseParser>{
+class ResponseParser: public ModbusParser<ResponseCallback, ResponseParser, ResponseDataCallback>{
   public:
     ResponseParser(){};
     
@@ -629,7 +941,7 @@ class ResponseParser: public ModbusParser<ResponseCallback, ResponseParser>{
 /*
 The request parser is the core of the modbus slave/server.
 */
-class RequestParser: public ModbusParser<RequestCallback, RequestParser>{
+class RequestParser: public ModbusParser<RequestCallback, RequestParser, RequestDataCallback>{
   public:
     RequestParser(){};
     ~RequestParser(){this->free();};
@@ -0,0 +1,298 @@
+/*
+mbplanner.h
+
+Contains:
+Definition of PollPlanner, which coalesces register reads into a minimal set of FC03/FC04 requests.
+Definition of PollRequest, one planned request frame.
+
+Remarks:
+The user registers interests (slave, function code, address, quantity) once.
+plan() sorts the interests and merges adjacent and nearly adjacent ranges.
+Gaps up to setMaxGap registers are read as well, as they are cheaper than an extra round trip.
+A request never exceeds 125 registers nor the byte count limit of the parser.
+
+When a response is complete, complete() maps the payload back to the interests
+and calls the register callback once per interest (or per part of a split interest).
+
+Capacities are fixed at compile time and can be changed with
+-D MBPLANNER_MAX_INTERESTS=n and -D MBPLANNER_MAX_REQUESTS=n
+*/
+#ifndef mbplanner_h
+#define mbplanner_h
+
+#include "mbparser.h"
+#include "mbframe.h"
+
+#ifndef MBPLANNER_MAX_INTERESTS
+#define MBPLANNER_MAX_INTERESTS 64
+#endif
+
+#ifndef MBPLANNER_MAX_REQUESTS
+#define MBPLANNER_MAX_REQUESTS 16
+#endif
+
+class PollPlanner;
+
+#ifdef STD_FUNCTIONAL
+  typedef std::function<void(PollPlanner *planner, uint8_t interest, uint16_t address, const uint8_t *data, uint16_t quantity)> PollCallback;
+#else
+  typedef void(*PollCallback)(PollPlanner *planner, uint8_t interest, uint16_t address, const uint8_t *data, uint16_t quantity);
+#endif
+
+/*
+A planned read request including its RTU frame.
+*/
+struct PollRequest{
+  uint8_t slave;
+  uint8_t functionCode;
+  uint16_t address;
+  uint16_t quantity;
+  uint8_t first; // first interest (in planned order) covered by this request
+  uint8_t frame[8];
+};
+
+class PollPlanner{
+  public:
+    PollPlanner(){};
+    PollPlanner(const PollPlanner&) = delete;
+    PollPlanner& operator= (const PollPlanner&) = delete;
+
+    /*
+    Adds an interest in quantity registers starting at address.
+    Only FC03 and FC04 are supported.
+    Returns the interest id or -1 when full or invalid.
+    The plan is invalid after adding an interest.
+    */
+    int16_t add(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity = 1){
+      if (_interestCount >= MBPLANNER_MAX_INTERESTS || quantity == 0
+          || (fc != 0x03 && fc != 0x04) || uint32_t(address) + quantity > 0x10000){
+        return -1;
+      }
+      Interest &interest = _interests[_interestCount];
+      interest.slave = slave;
+      interest.functionCode = fc;
+      interest.address = address;
+      interest.quantity = quantity;
+      _requestCount = 0;
+      return _interestCount++;
+    }
+
+    /*
+    Removes all interests and the plan.
+    */
+    void clear(){
+      _interestCount = 0;
+      _requestCount = 0;
+    }
+
+    /*
+    Sets the largest gap of unused registers which is read to merge two ranges.
+    Default is 8 registers.
+    */
+    void setMaxGap(uint16_t registers){
+      _maxGap = registers;
+    }
+
+    /*
+    Sets limit for payload of one response.
+    Should match setByteCountLimit of the parser, which receives the responses.
+    The default limit is 96 bytes.
+    */
+    void setByteCountLimit(size_t size){
+      _byteCountLimit = size;
+    }
+
+    /*
+    Sets callback which is called by complete() for each interest in the response.
+    */
+    void setOnRegisterCB(PollCallback cb){
+      _onRegister = cb;
+    }
+
+    /*
+    Sets void pointer to keep reference to third party objects.
+    */
+    void setExtension(void* ptr){
+      _extension = ptr;
+    }
+
+    void* getExtension(){
+      return _extension;
+    }
+
+    /*
+    Builds the request set.
+    Returns the number of requests, zero without interests
+    or -1 if the plan does not fit into MBPLANNER_MAX_REQUESTS.
+    */
+    int16_t plan(){
+      _requestCount = 0;
+      _sort();
+      uint16_t maxQuantity = _maxQuantity();
+      if (_interestCount == 0){
+        return 0;
+      }
+      if (maxQuantity == 0){
+        return -1;
+      }
+
+      bool open = false;
+      uint8_t first = 0;
+      uint32_t start = 0;
+      uint32_t end = 0; // last register, inclusive
+      for (uint8_t pos = 0; pos < _interestCount; pos++){
+        const Interest &interest = _interests[_order[pos]];
+        uint32_t last = uint32_t(interest.address) + interest.quantity - 1;
+        if (open && _sameKey(_interests[_order[first]], interest)){
+          if (interest.address <= end + _maxGap + 1 && max(end, last) - start + 1 <= maxQuantity){
+            end = max(end, last);
+            continue;
+          }
+          if (!_emit(first, start, end)){
+            return -1;
+          }
+          // an overlapping interest continues after the emitted request
+          start = max(uint32_t(interest.address), end + 1);
+        } else {
+          if (open && !_emit(first, start, end)){
+            return -1;
+          }
+          start = interest.address;
+        }
+        first = pos;
+        end = last;
+        open = true;
+        // interests exceeding one request are split
+        while (end - start + 1 > maxQuantity){
+          if (!_emit(first, start, start + maxQuantity - 1)){
+            return -1;
+          }
+          start += maxQuantity;
+        }
+      }
+      if (open && !_emit(first, start, end)){
+        return -1;
+      }
+      return _requestCount;
+    }
+
+    /*
+    Maps a completed response of request idx back to the interests.
+    Calls the register callback for each covered interest.
+    Returns false if the response does not belong to the request.
+    */
+    bool complete(uint8_t idx, const ResponseParser &parser){
+      if (idx >= _requestCount || !parser.isComplete()){
+        return false;
+      }
+      const PollRequest &request = _requests[idx];
+      if (parser.slaveAddress() != request.slave || parser.functionCode() != request.functionCode
+          || parser.byteCount() != request.quantity * 2 || parser.data() == nullptr){
+        return false;
+      }
+      if (!_onRegister){
+        return true;
+      }
+      uint32_t requestEnd = uint32_t(request.address) + request.quantity;
+      for (uint8_t pos = request.first; pos < _interestCount; pos++){
+        uint8_t id = _order[pos];
+        const Interest &interest = _interests[id];
+        if (!_sameKey(interest, _interests[_order[request.first]]) || interest.address >= requestEnd){
+          break;
+        }
+        uint32_t from = max(uint32_t(interest.address), uint32_t(request.address));
+        uint32_t to = min(uint32_t(interest.address) + interest.quantity, requestEnd);
+        if (from < to){
+          _onRegister(this, id, from, parser.data() + (from - request.address) * 2, to - from);
+        }
+      }
+      return true;
+    }
+
+    // ---GETTERS---
+
+    uint8_t requests() const {
+      return _requestCount;
+    }
+
+    const PollRequest& request(uint8_t idx) const {
+      return _requests[idx];
+    }
+
+    uint8_t interests() const {
+      return _interestCount;
+    }
+
+    uint16_t maxGap() const {
+      return _maxGap;
+    }
+
+  private:
+    struct Interest{
+      uint8_t slave;
+      uint8_t functionCode;
+      uint16_t address;
+      uint16_t quantity;
+    };
+
+    Interest _interests[MBPLANNER_MAX_INTERESTS];
+    uint8_t _order[MBPLANNER_MAX_INTERESTS];
+    uint8_t _interestCount{0};
+
+    PollRequest _requests[MBPLANNER_MAX_REQUESTS];
+    uint8_t _requestCount{0};
+
+    uint16_t _maxGap{8};
+    size_t _byteCountLimit{96};
+
+    PollCallback _onRegister{nullptr};
+    void* _extension{nullptr};
+
+    uint16_t _maxQuantity() const {
+      return min(size_t(MB_MAX_READ_REGISTERS), _byteCountLimit / 2);
+    }
+
+    static bool _sameKey(const Interest &a, const Interest &b){
+      return a.slave == b.slave && a.functionCode == b.functionCode;
+    }
+
+    static bool _less(const Interest &a, const Interest &b){
+      if (a.slave != b.slave) return a.slave < b.slave;
+      if (a.functionCode != b.functionCode) return a.functionCode < b.functionCode;
+      return a.address < b.address;
+    }
+
+    /*
+    Insertion sort of the interest order by slave, function code and address.
+    Interest lists are short and mostly presorted.
+    */
+    void _sort(){
+      for (uint8_t pos = 0; pos < _interestCount; pos++){
+        uint8_t id = pos;
+        uint8_t idx = pos;
+        while (idx > 0 && _less(_interests[id], _interests[_order[idx - 1]])){
+          _order[idx] = _order[idx - 1];
+          idx--;
+        }
+        _order[idx] = id;
+      }
+    }
+
+    bool _emit(uint8_t first, uint32_t start, uint32_t end){
+      if (_requestCount >= MBPLANNER_MAX_REQUESTS){
+        _requestCount = 0;
+        return false;
+      }
+      const Interest &interest = _interests[_order[first]];
+      PollRequest &request = _requests[_requestCount++];
+      request.slave = interest.slave;
+      request.functionCode = interest.functionCode;
+      request.address = start;
+      request.quantity = end - start + 1;
+      request.first = first;
+      ModbusFrame::readRequest(request.frame, request.slave, request.functionCode, request.address, request.quantity);
+      return true;
+    }
+};
+
+#endif
@@ -0,0 +1,310 @@
+/*
+mbschema.h
+
+Contains:
+Definition of RegisterField, a compile time description of one device register.
+Definition of RegisterSchema, a compile time register map of a device, which generates
+the read requests and decodes completed responses straight into a plain struct.
+Type safe enums for register types and word order.
+
+Remarks:
+All addresses, offsets, word orders and scales are template parameters. The decoder of a
+request is unrolled at compile time: for each field it is a load from a constant offset of
+the payload, a constant word order and an optional constant scale. There is no interpretive
+loop over a register table at runtime.
+
+The requests are planned at compile time as well. Fields are clustered by address,
+a gap of more than MBSCHEMA_MAX_GAP (default 16) unused registers starts a new request,
+as does a cluster exceeding MBSCHEMA_MAX_REGISTERS (default 125) registers.
+Only registers between fields of one cluster are read, a field never crosses two requests.
+The payload must not be swapped by the parser (setSwap).
+
+Example for two registers of the Eastron SDM72D:
+
+struct Meter{
+  float voltage;
+  float power;
+};
+
+typedef RegisterSchema<Meter, 0x04,
+  MB_FIELD(Meter, voltage, 0x0000, RegisterType::float32),
+  MB_FIELD(Meter, power, 0x000C, RegisterType::float32)
+> MeterSchema;
+*/
+#ifndef mbschema_h
+#define mbschema_h
+
+#include "mbparser.h"
+#include "mbframe.h"
+
+#ifndef MBSCHEMA_MAX_REGISTERS
+#define MBSCHEMA_MAX_REGISTERS MB_MAX_READ_REGISTERS
+#endif
+
+#ifndef MBSCHEMA_MAX_GAP
+#define MBSCHEMA_MAX_GAP 16
+#endif
+
+#define MBSCHEMA_NONE 0x10000
+
+enum class RegisterType{
+  uint16 = 0,
+  int16 = 1,
+  uint32 = 2,
+  int32 = 3,
+  float32 = 4
+};
+
+enum class WordOrder{
+  highFirst = 0, // modbus default
+  lowFirst = 1
+};
+
+/*
+Declares a field of a schema.
+Optional arguments are word order, scale numerator and scale denominator.
+*/
+#define MB_FIELD(TStruct, member, address, type, ...) \
+  RegisterField<TStruct, decltype(TStruct::member), &TStruct::member, address, type, ##__VA_ARGS__>
+
+template<bool> struct SchemaTag{};
+
+template<typename TStruct, typename TValue, TValue TStruct::*Member, uint16_t Address, RegisterType Type,
+         WordOrder Order = WordOrder::highFirst, int32_t ScaleNumerator = 1, int32_t ScaleDenominator = 1>
+class RegisterField{
+  public:
+    static constexpr uint16_t address(){
+      return Address;
+    }
+
+    static constexpr uint16_t words(){
+      return Type == RegisterType::uint16 || Type == RegisterType::int16 ? 1 : 2;
+    }
+
+    static constexpr uint32_t end(){
+      return uint32_t(Address) + words();
+    }
+
+    /*
+    True if the field lies within a request starting at Base.
+    */
+    static constexpr bool within(uint32_t base, uint32_t quantity){
+      return Address >= base && end() <= base + quantity;
+    }
+
+    /*
+    Decodes the field, if it is part of the request [Base, Base + Quantity).
+    Resolved at compile time.
+    */
+    template<uint16_t Base, uint16_t Quantity>
+    static void decode(const uint8_t *data, TStruct &out){
+      _decode<Base>(data, out, SchemaTag<within(Base, Quantity)>());
+    }
+
+  private:
+    static_assert(ScaleDenominator != 0, "scale denominator must not be zero");
+
+    template<uint16_t Base>
+    static void _decode(const uint8_t *, TStruct &, SchemaTag<false>){}
+
+    template<uint16_t Base>
+    static void _decode(const uint8_t *data, TStruct &out, SchemaTag<true>){
+      const uint8_t *ptr = data + (Address - Base) * 2;
+      out.*Member = _scale(_convert(ptr, SchemaTag<Type == RegisterType::float32>()));
+    }
+
+    static uint16_t _word(const uint8_t *ptr){
+      return (uint16_t(ptr[0]) << 8) | ptr[1];
+    }
+
+    static uint32_t _dword(const uint8_t *ptr){
+      uint32_t first = _word(ptr);
+      uint32_t second = _word(ptr + 2);
+      return Order == WordOrder::highFirst ? (first << 16) | second : (second << 16) | first;
+    }
+
+    static float _convert(const uint8_t *ptr, SchemaTag<true>){
+      uint32_t bits = _dword(ptr);
+      float value;
+      memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+
+    static int32_t _convertInteger(const uint8_t *ptr){
+      switch (Type){
+        case RegisterType::uint16:
+          return _word(ptr);
+        case RegisterType::int16:
+          return int16_t(_word(ptr));
+        default:
+          return int32_t(_dword(ptr));
+      }
+    }
+
+    static TValue _convert(const uint8_t *ptr, SchemaTag<false>){
+      if (Type == RegisterType::uint32){
+        return TValue(_dword(ptr));
+      }
+      return TValue(_convertInteger(ptr));
+    }
+
+    template<typename T>
+    static TValue _scale(T value){
+      if (ScaleNumerator == 1 && ScaleDenominator == 1){
+        return TValue(value);
+      }
+      return TValue(value) * TValue(ScaleNumerator) / TValue(ScaleDenominator);
+    }
+};
+
+/*
+Compile time folds over the fields of a schema.
+next returns the lowest address of the fields ending after end, MBSCHEMA_NONE if there is none.
+grow returns the end of the request [start, end) extended by the fields following within the
+gap limit, which end before limit.
+*/
+template<typename... Fields>
+struct SchemaBounds;
+
+template<typename Field>
+struct SchemaBounds<Field>{
+  static constexpr uint16_t first(){
+    return Field::address();
+  }
+  static constexpr uint32_t next(uint32_t end){
+    return Field::end() > end ? Field::address() : MBSCHEMA_NONE;
+  }
+  static constexpr uint32_t grow(uint32_t start, uint32_t end, uint32_t limit){
+    return Field::address() >= start && Field::address() <= end + MBSCHEMA_MAX_GAP
+        && Field::end() <= limit && Field::end() > end ? Field::end() : end;
+  }
+};
+
+template<typename Field, typename... Rest>
+struct SchemaBounds<Field, Rest...>{
+  static constexpr uint16_t first(){
+    return Field::address() < SchemaBounds<Rest...>::first() ? Field::address() : SchemaBounds<Rest...>::first();
+  }
+  static constexpr uint32_t next(uint32_t end){
+    return SchemaBounds<Field>::next(end) < SchemaBounds<Rest...>::next(end)
+        ? SchemaBounds<Field>::next(end) : SchemaBounds<Rest...>::next(end);
+  }
+  static constexpr uint32_t grow(uint32_t start, uint32_t end, uint32_t limit){
+    return SchemaBounds<Field>::grow(start, end, limit) > SchemaBounds<Rest...>::grow(start, end, limit)
+        ? SchemaBounds<Field>::grow(start, end, limit) : SchemaBounds<Rest...>::grow(start, end, limit);
+  }
+};
+
+template<typename TStruct, uint8_t FunctionCode, typename... Fields>
+class RegisterSchema{
+  public:
+    static_assert(sizeof...(Fields) > 0, "schema needs at least one field");
+    static_assert(FunctionCode == 0x03 || FunctionCode == 0x04, "schema is read by FC03 or FC04");
+    static_assert(MBSCHEMA_MAX_REGISTERS >= 2 && MBSCHEMA_MAX_REGISTERS <= MB_MAX_READ_REGISTERS,
+                  "MBSCHEMA_MAX_REGISTERS must hold a 32 bit field and fit into a read request");
+
+    static constexpr uint16_t first(){
+      return SchemaBounds<Fields...>::first();
+    }
+
+    /*
+    Number of requests to read the schema.
+    */
+    static constexpr uint8_t requests(){
+      return _count(first());
+    }
+
+    static constexpr uint16_t requestAddress(uint8_t idx){
+      return _start(idx);
+    }
+
+    static constexpr uint16_t requestQuantity(uint8_t idx){
+      return _end(_start(idx)) - _start(idx);
+    }
+
+    /*
+    Largest payload of a response.
+    Use for setByteCountLimit of the parser.
+    */
+    static constexpr size_t maxByteCount(){
+      return 2 * _maxQuantity(0);
+    }
+
+    /*
+    Builds request idx into buffer, which must hold 8 bytes.
+    Returns the length of the frame.
+    */
+    static uint16_t request(uint8_t idx, uint8_t slave, uint8_t *buffer){
+      return _request<0>(idx, slave, buffer, SchemaTag<(0 < requests())>());
+    }
+
+    /*
+    Decodes the completed response of request idx into out.
+    Returns false if the response does not belong to the request.
+    */
+    static bool decode(uint8_t idx, const ResponseParser &parser, TStruct &out){
+      if (!parser.isComplete() || parser.functionCode() != FunctionCode){
+        return false;
+      }
+      return _decodeRequest<0>(idx, parser, out, SchemaTag<(0 < requests())>());
+    }
+
+  private:
+    static constexpr uint32_t _grow(uint32_t start, uint32_t end){
+      return SchemaBounds<Fields...>::grow(start, end, start + MBSCHEMA_MAX_REGISTERS) == end
+          ? end : _grow(start, SchemaBounds<Fields...>::grow(start, end, start + MBSCHEMA_MAX_REGISTERS));
+    }
+
+    /*
+    End of the request starting at start.
+    */
+    static constexpr uint32_t _end(uint32_t start){
+      return _grow(start, start);
+    }
+
+    static constexpr uint32_t _start(uint8_t idx){
+      return idx == 0 ? first() : SchemaBounds<Fields...>::next(_end(_start(idx - 1)));
+    }
+
+    static constexpr uint8_t _count(uint32_t start){
+      return start == MBSCHEMA_NONE ? 0 : 1 + _count(SchemaBounds<Fields...>::next(_end(start)));
+    }
+
+    static constexpr uint16_t _maxQuantity(uint8_t idx){
+      return idx >= requests() ? 0
+          : requestQuantity(idx) > _maxQuantity(idx + 1) ? requestQuantity(idx) : _maxQuantity(idx + 1);
+    }
+
+    template<uint8_t Idx>
+    static uint16_t _request(uint8_t, uint8_t, uint8_t *, SchemaTag<false>){
+      return 0;
+    }
+
+    template<uint8_t Idx>
+    static uint16_t _request(uint8_t idx, uint8_t slave, uint8_t *buffer, SchemaTag<true>){
+      if (idx == Idx){
+        return ModbusFrame::readRequest(buffer, slave, FunctionCode, requestAddress(Idx), requestQuantity(Idx));
+      }
+      return _request<Idx + 1>(idx, slave, buffer, SchemaTag<(Idx + 1 < requests())>());
+    }
+
+    template<uint8_t Idx>
+    static bool _decodeRequest(uint8_t, const ResponseParser &, TStruct &, SchemaTag<false>){
+      return false;
+    }
+
+    template<uint8_t Idx>
+    static bool _decodeRequest(uint8_t idx, const ResponseParser &parser, TStruct &out, SchemaTag<true>){
+      if (idx != Idx){
+        return _decodeRequest<Idx + 1>(idx, parser, out, SchemaTag<(Idx + 1 < requests())>());
+      }
+      if (parser.byteCount() != requestQuantity(Idx) * 2 || parser.data() == nullptr){
+        return false;
+      }
+      int unrolled[] = {0, (Fields::template decode<requestAddress(Idx), requestQuantity(Idx)>(parser.data(), out), 0)...};
+      (void)unrolled;
+      return true;
+    }
+};
+
+#endif
@@ -0,0 +1,513 @@
+/*
+mbsim.h
+
+Contains:
+Definition of TrafficGenerator, a deterministic generator of modbus RTU traffic with fault injection.
+Definition of SlaveSimulator, a simulated modbus slave on top of RequestParser.
+Type safe enums for traffic mode and injected faults.
+
+Remarks:
+The generator emits requests, responses or paired transactions over all supported
+function codes, a range of slave ids and payload sizes. Faults are injected with a
+configurable rate: CRC errors, truncated frames, exception responses and frames of
+foreign slaves. The same seed always produces the same traffic.
+
+The simulator answers requests from a register and coil image. Like the parsers it does
+not own a transport; responses are handed to a writer callback, which may write to a pipe,
+a pty, a socket or directly into another parser.
+
+The image size is fixed at compile time and can be changed with
+-D MBSIM_REGISTERS=n and -D MBSIM_COILS=n
+*/
+#ifndef mbsim_h
+#define mbsim_h
+
+#include "mbparser.h"
+#include "mbframe.h"
+
+#ifndef MBSIM_REGISTERS
+#define MBSIM_REGISTERS 256
+#endif
+
+#ifndef MBSIM_COILS
+#define MBSIM_COILS 256
+#endif
+
+enum class TrafficMode{
+  requests = 0,
+  responses = 1,
+  transactions = 2 // request followed by its response
+};
+
+enum class FrameFault{
+  none = 0,
+  crcError = 1,
+  truncated = 2,
+  exception = 3,
+  foreignSlave = 4
+};
+
+/*
+Describes a generated frame.
+*/
+struct GeneratedFrame{
+  bool request;
+  uint8_t slave;
+  uint8_t functionCode;
+  uint16_t address;
+  uint16_t quantity;
+  FrameFault fault;
+};
+
+class TrafficGenerator{
+  public:
+    TrafficGenerator(uint32_t seed = 1){
+      this->seed(seed);
+      for (uint8_t idx = 0; idx < 8; idx++){
+        _weights[idx] = 1;
+      }
+      for (uint8_t idx = 0; idx < 5; idx++){
+        _faultRates[idx] = 0;
+      }
+    };
+
+    /*
+    Restarts the pseudo random sequence.
+    */
+    void seed(uint32_t seed){
+      _state = seed ? seed : 0x9E3779B9;
+      _pending = false;
+    }
+
+    void setMode(TrafficMode mode){
+      _mode = mode;
+      _pending = false;
+    }
+
+    /*
+    Sets the range of slave ids. Default is 1..1
+    */
+    void setSlaves(uint8_t first, uint8_t last){
+      _firstSlave = first;
+      _lastSlave = max(first, last);
+    }
+
+    /*
+    Sets relative weight of a function code in the mix.
+    Zero disables the function code. Default weight is 1 for all.
+    */
+    void setFunctionWeight(uint8_t fc, uint8_t weight){
+      int8_t idx = _functionIndex(fc);
+      if (idx >= 0){
+        _weights[idx] = weight;
+      }
+    }
+
+    /*
+    Sets limit of generated payloads.
+    Should match setByteCountLimit of the parser under test. Default is 96 bytes.
+    */
+    void setByteCountLimit(size_t size){
+      _byteCountLimit = max(size_t(2), min(size, size_t(MB_MAX_PDU - 3)));
+    }
+
+    /*
+    Sets rate of a fault in frames per thousand frames.
+    */
+    void setFaultRate(FrameFault fault, uint16_t perMille){
+      _faultRates[static_cast<uint8_t>(fault)] = perMille;
+    }
+
+    /*
+    Generates the next frame into buffer, which must hold MB_RTU_MAX_ADU bytes.
+    Returns the length of the frame.
+    */
+    uint16_t next(uint8_t *buffer, GeneratedFrame &frame){
+      uint16_t len;
+      if (_pending){
+        frame = _last;
+        frame.request = false;
+        _pending = false;
+      } else {
+        frame.request = _mode != TrafficMode::responses;
+        frame.slave = _firstSlave + random() % (uint16_t(_lastSlave) - _firstSlave + 1);
+        frame.functionCode = _pickFunction();
+        _pickRange(frame);
+        _pending = _mode == TrafficMode::transactions;
+        _last = frame;
+      }
+      frame.fault = _pickFault(frame.request);
+      if (frame.fault == FrameFault::foreignSlave){
+        frame.slave = _foreignSlave();
+      }
+      if (frame.fault == FrameFault::exception){
+        len = ModbusFrame::exception(buffer, frame.slave, frame.functionCode, static_cast<ErrorCode>(1 + random() % 4));
+      } else if (frame.request){
+        len = _request(buffer, frame);
+      } else {
+        len = _response(buffer, frame);
+      }
+      if (frame.fault == FrameFault::crcError){
+        buffer[len - 1 - random() % 2] ^= 1 + random() % 255;
+      } else if (frame.fault == FrameFault::truncated){
+        len = 1 + random() % (len - 1);
+      }
+      return len;
+    }
+
+    /*
+    xorshift32 pseudo random number.
+    */
+    uint32_t random(){
+      _state ^= _state << 13;
+      _state ^= _state >> 17;
+      _state ^= _state << 5;
+      return _state;
+    }
+
+  private:
+    const uint8_t _functionCodes[8] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x0F, 0x10};
+    uint8_t _weights[8];
+    uint16_t _faultRates[5];
+
+    uint32_t _state;
+    TrafficMode _mode{TrafficMode::responses};
+    uint8_t _firstSlave{1};
+    uint8_t _lastSlave{1};
+    size_t _byteCountLimit{96};
+
+    bool _pending{false};
+    GeneratedFrame _last{};
+    uint16_t _lastValue{0};
+    uint8_t _payload[MB_MAX_PDU];
+
+    int8_t _functionIndex(uint8_t fc) const {
+      for (uint8_t idx = 0; idx < 8; idx++){
+        if (_functionCodes[idx] == fc){
+          return idx;
+        }
+      }
+      return -1;
+    }
+
+    uint8_t _pickFunction(){
+      uint16_t total = 0;
+      for (uint8_t idx = 0; idx < 8; idx++){
+        total += _weights[idx];
+      }
+      if (total == 0){
+        return 0x03;
+      }
+      uint16_t pick = random() % total;
+      for (uint8_t idx = 0; idx < 8; idx++){
+        if (pick < _weights[idx]){
+          return _functionCodes[idx];
+        }
+        pick -= _weights[idx];
+      }
+      return 0x03;
+    }
+
+    FrameFault _pickFault(bool request){
+      uint16_t pick = random() % 1000;
+      for (uint8_t idx = 1; idx < 5; idx++){
+        if (pick < _faultRates[idx]){
+          FrameFault fault = static_cast<FrameFault>(idx);
+          // requests have no exceptions
+          return request && fault == FrameFault::exception ? FrameFault::none : fault;
+        }
+        pick -= _faultRates[idx];
+      }
+      return FrameFault::none;
+    }
+
+    uint8_t _foreignSlave(){
+      if (_lastSlave < 247){
+        return _lastSlave + 1 + random() % (247 - _lastSlave);
+      }
+      return _firstSlave > 1 ? _firstSlave - 1 : 0;
+    }
+
+    bool _isBitFunction(uint8_t fc) const {
+      return fc == 0x01 || fc == 0x02 || fc == 0x05 || fc == 0x0F;
+    }
+
+    void _pickRange(GeneratedFrame &frame){
+      uint16_t maxQuantity = _isBitFunction(frame.functionCode) ? _byteCountLimit * 8 : _byteCountLimit / 2;
+      switch (frame.functionCode){
+        case 0x05:
+        case 0x06:
+          frame.quantity = 1;
+          break;
+        case 0x0F:
+          maxQuantity = min(maxQuantity, uint16_t(MB_MAX_WRITE_BITS));
+          frame.quantity = 1 + random() % maxQuantity;
+          break;
+        case 0x10:
+          maxQuantity = min(maxQuantity, uint16_t(MB_MAX_WRITE_REGISTERS));
+          frame.quantity = 1 + random() % maxQuantity;
+          break;
+        default:
+          maxQuantity = min(maxQuantity, uint16_t(_isBitFunction(frame.functionCode) ? MB_MAX_READ_BITS : MB_MAX_READ_REGISTERS));
+          frame.quantity = 1 + random() % maxQuantity;
+          break;
+      }
+      frame.address = random() % (0x10000 - frame.quantity);
+    }
+
+    uint8_t _byteCount(const GeneratedFrame &frame) const {
+      return _isBitFunction(frame.functionCode) ? (frame.quantity + 7) / 8 : frame.quantity * 2;
+    }
+
+    void _randomPayload(uint8_t len){
+      for (uint8_t idx = 0; idx < len; idx++){
+        _payload[idx] = random();
+      }
+    }
+
+    uint16_t _singleValue(const GeneratedFrame &frame){
+      if (frame.functionCode == 0x05){
+        return random() & 1 ? 0xFF00 : 0x0000;
+      }
+      return random();
+    }
+
+    uint16_t _request(uint8_t *buffer, const GeneratedFrame &frame){
+      switch (frame.functionCode){
+        case 0x05:
+        case 0x06:
+          _lastValue = _singleValue(frame);
+          return ModbusFrame::writeSingle(buffer, frame.slave, frame.functionCode, frame.address, _lastValue);
+        case 0x0F:
+        case 0x10:
+          _randomPayload(_byteCount(frame));
+          return ModbusFrame::writeMultiple(buffer, frame.slave, frame.functionCode, frame.address, frame.quantity,
+                                            _payload, _byteCount(frame));
+        default:
+          return ModbusFrame::readRequest(buffer, frame.slave, frame.functionCode, frame.address, frame.quantity);
+      }
+    }
+
+    uint16_t _response(uint8_t *buffer, const GeneratedFrame &frame){
+      switch (frame.functionCode){
+        case 0x05:
+        case 0x06:
+          // echo of the request
+          if (_mode != TrafficMode::transactions){
+            _lastValue = _singleValue(frame);
+          }
+          return ModbusFrame::writeSingle(buffer, frame.slave, frame.functionCode, frame.address, _lastValue);
+        case 0x0F:
+        case 0x10:
+          return ModbusFrame::writeMultipleResponse(buffer, frame.slave, frame.functionCode, frame.address, frame.quantity);
+        default:
+          _randomPayload(_byteCount(frame));
+          return ModbusFrame::readResponse(buffer, frame.slave, frame.functionCode, _payload, _byteCount(frame));
+      }
+    }
+};
+
+class SlaveSimulator;
+
+#ifdef STD_FUNCTIONAL
+  typedef std::function<void(SlaveSimulator *simulator, const uint8_t *frame, uint16_t len)> SimulatorWriter;
+#else
+  typedef void(*SimulatorWriter)(SlaveSimulator *simulator, const uint8_t *frame, uint16_t len);
+#endif
+
+/*
+Simulated slave.
+FC03 and FC04 read the register image, FC01 and FC02 the coil image.
+Requests outside the image are answered with illegalDataAddress.
+*/
+class SlaveSimulator{
+  public:
+    SlaveSimulator(uint8_t slave = 1){
+      _parser.setSlaveAddress(slave);
+      _parser.setByteCountLimit(MB_MAX_PDU - 6);
+      _parser.setExtension(this);
+      _parser.setOnCompleteCB(_onRequest);
+      memset(_registers, 0, sizeof(_registers));
+      memset(_coils, 0, sizeof(_coils));
+    };
+    SlaveSimulator(const SlaveSimulator&) = delete;
+    SlaveSimulator& operator= (const SlaveSimulator&) = delete;
+
+    /*
+    Sets writer which sends responses.
+    */
+    void setWriter(SimulatorWriter cb){
+      _writer = cb;
+    }
+
+    /*
+    Parses bytes received from the master.
+    Responses are written from within parse.
+    */
+    ParserState parse(uint8_t *buffer, uint16_t len){
+      return _parser.parse(buffer, len);
+    }
+
+    void setRegister(uint16_t address, uint16_t value){
+      if (address < MBSIM_REGISTERS){
+        _registers[address] = value;
+      }
+    }
+
+    uint16_t getRegister(uint16_t address) const {
+      return address < MBSIM_REGISTERS ? _registers[address] : 0;
+    }
+
+    void setCoil(uint16_t address, bool value){
+      if (address < MBSIM_COILS){
+        if (value){
+          _coils[address / 8] |= 1 << (address % 8);
+        } else {
+          _coils[address / 8] &= ~(1 << (address % 8));
+        }
+      }
+    }
+
+    bool getCoil(uint16_t address) const {
+      return address < MBSIM_COILS && (_coils[address / 8] >> (address % 8)) & 1;
+    }
+
+    /*
+    Sets void pointer to keep reference to third party objects.
+    */
+    void setExtension(void* ptr){
+      _extension = ptr;
+    }
+
+    void* getExtension(){
+      return _extension;
+    }
+
+    // ---GETTERS---
+
+    uint32_t served() const {
+      return _served;
+    }
+
+    uint32_t exceptions() const {
+      return _exceptions;
+    }
+
+    RequestParser& parser(){
+      return _parser;
+    }
+
+  private:
+    RequestParser _parser{};
+    uint16_t _registers[MBSIM_REGISTERS];
+    uint8_t _coils[(MBSIM_COILS + 7) / 8];
+    uint8_t _tx[MB_RTU_MAX_ADU];
+    uint8_t _payload[MB_MAX_PDU];
+
+    SimulatorWriter _writer{nullptr};
+    uint32_t _served{0};
+    uint32_t _exceptions{0};
+    void* _extension{nullptr};
+
+    static void _onRequest(RequestParser *parser){
+      static_cast<SlaveSimulator*>(parser->getExtension())->_answer(*parser);
+    }
+
+    void _answer(const RequestParser &request){
+      uint16_t len = 0;
+      ErrorCode code = _execute(request, len);
+      if (code != ErrorCode::noError){
+        len = ModbusFrame::exception(_tx, request.slaveAddress(), request.functionCode(), code);
+        _exceptions++;
+      }
+      _served++;
+      if (_writer){
+        _writer(this, _tx, len);
+      }
+    }
+
+    ErrorCode _execute(const RequestParser &request, uint16_t &len){
+      uint8_t slave = request.slaveAddress();
+      uint8_t fc = request.functionCode();
+      uint16_t address = request.address();
+      uint16_t quantity = request.quantity();
+      switch (fc){
+        case 0x01:
+        case 0x02:
+          // the byte count is derived from quantity, keep it within _payload
+          if (quantity > MB_MAX_READ_BITS){
+            return ErrorCode::illegalDataValue;
+          }
+          if (uint32_t(address) + quantity > MBSIM_COILS){
+            return ErrorCode::illegalDataAddress;
+          }
+          memset(_payload, 0, (quantity + 7) / 8);
+          for (uint16_t idx = 0; idx < quantity; idx++){
+            _payload[idx / 8] |= getCoil(address + idx) << (idx % 8);
+          }
+          len = ModbusFrame::readResponse(_tx, slave, fc, _payload, (quantity + 7) / 8);
+          return ErrorCode::noError;
+        case 0x03:
+        case 0x04:
+          if (quantity > MB_MAX_READ_REGISTERS){
+            return ErrorCode::illegalDataValue;
+          }
+          if (uint32_t(address) + quantity > MBSIM_REGISTERS){
+            return ErrorCode::illegalDataAddress;
+          }
+          for (uint16_t idx = 0; idx < quantity; idx++){
+            _payload[2 * idx] = highByte(_registers[address + idx]);
+            _payload[2 * idx + 1] = lowByte(_registers[address + idx]);
+          }
+          len = ModbusFrame::readResponse(_tx, slave, fc, _payload, quantity * 2);
+          return ErrorCode::noError;
+        case 0x05:{
+          uint16_t value = ModbusFrame::getWord(request.data());
+          if (value != 0xFF00 && value != 0x0000){
+            return ErrorCode::illegalDataValue;
+          }
+          if (address >= MBSIM_COILS){
+            return ErrorCode::illegalDataAddress;
+          }
+          setCoil(address, value);
+          len = ModbusFrame::writeSingle(_tx, slave, fc, address, value);
+          return ErrorCode::noError;
+        }
+        case 0x06:
+          if (address >= MBSIM_REGISTERS){
+            return ErrorCode::illegalDataAddress;
+          }
+          _registers[address] = ModbusFrame::getWord(request.data());
+          len = ModbusFrame::writeSingle(_tx, slave, fc, address, _registers[address]);
+          return ErrorCode::noError;
+        case 0x0F:
+          if (request.byteCount() != (quantity + 7) / 8){
+            return ErrorCode::illegalDataValue;
+          }
+          if (uint32_t(address) + quantity > MBSIM_COILS){
+            return ErrorCode::illegalDataAddress;
+          }
+          for (uint16_t idx = 0; idx < quantity; idx++){
+            setCoil(address + idx, (request.data()[idx / 8] >> (idx % 8)) & 1);
+          }
+          len = ModbusFrame::writeMultipleResponse(_tx, slave, fc, address, quantity);
+          return ErrorCode::noError;
+        case 0x10:
+          if (request.byteCount() != quantity * 2){
+            return ErrorCode::illegalDataValue;
+          }
+          if (uint32_t(address) + quantity > MBSIM_REGISTERS){
+            return ErrorCode::illegalDataAddress;
+          }
+          for (uint16_t idx = 0; idx < quantity; idx++){
+            _registers[address + idx] = ModbusFrame::getWord(request.data() + 2 * idx);
+          }
+          len = ModbusFrame::writeMultipleResponse(_tx, slave, fc, address, quantity);
+          return ErrorCode::noError;
+        default:
+          return ErrorCode::illegalFunction;
+      }
+    }
+};
+
+#endif
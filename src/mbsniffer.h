@@ -0,0 +1,271 @@
+/*
+mbsniffer.h
+
+Contains:
+Definition of BusSniffer, a passive monitor which decodes requests and responses
+from one byte stream and pairs them to transactions.
+Definition of SniffedTransaction.
+
+Remarks:
+A RequestParser or ResponseParser alone assumes that the stream contains only one direction.
+On a shared RS485 line both directions are interleaved. The sniffer runs both parsers over the
+same bytes. The first parser which completes a frame with a valid CRC decides the direction
+and the other parser is realigned to the next frame.
+
+Some frames are valid in both directions, e.g. write single frames (FC05, FC06) or a FC01 response
+with three data bytes, which has the size of a request. They are decided by the previous request:
+a frame which answers the outstanding request is its response.
+While the payload of the expected read response is received, CRC matches of the request parser
+inside the payload are ignored.
+
+Exception responses are completed by the response parser in exception state. They are paired
+when they match the outstanding request, otherwise they are reported without request
+like any other response.
+
+All bytes of one parse call get the same timestamp. Latency is the time between the end of the
+request and the end of the response.
+*/
+#ifndef mbsniffer_h
+#define mbsniffer_h
+
+#include "mbparser.h"
+#include "mbframe.h"
+
+/*
+A request paired with its response.
+Unanswered requests and responses without a seen request are reported as well.
+*/
+struct SniffedTransaction{
+  bool hasRequest;
+  bool hasResponse;
+  uint8_t slave;
+  uint8_t functionCode;
+  uint16_t address;
+  uint16_t quantity;
+  ErrorCode exception;      // modbus exception of the response
+  unsigned long requestAt;  // end of request
+  unsigned long responseAt; // end of response
+  unsigned long latency;
+};
+
+class BusSniffer;
+
+#ifdef STD_FUNCTIONAL
+  typedef std::function<void(BusSniffer *sniffer, const SniffedTransaction &transaction, ResponseParser *response)> SnifferCallback;
+#else
+  typedef void(*SnifferCallback)(BusSniffer *sniffer, const SniffedTransaction &transaction, ResponseParser *response);
+#endif
+
+class BusSniffer{
+  public:
+    BusSniffer(){
+      _request.setByteCountLimit(MB_MAX_PDU - 6);
+      _response.setByteCountLimit(MB_MAX_PDU - 2);
+    };
+    BusSniffer(const BusSniffer&) = delete;
+    BusSniffer& operator= (const BusSniffer&) = delete;
+
+    /*
+    Sets callback which is called for each transaction.
+    The response parser is only valid during the callback.
+    It is nullptr if the transaction has no regular response.
+    */
+    void setOnTransactionCB(SnifferCallback cb){
+      _onTransaction = cb;
+    }
+
+    /*
+    Sets void pointer to keep reference to third party objects.
+    */
+    void setExtension(void* ptr){
+      _extension = ptr;
+    }
+
+    void* getExtension(){
+      return _extension;
+    }
+
+    /*
+    Parses bytes tapped from the bus at time now.
+    */
+    void parse(const uint8_t *buffer, uint16_t len, unsigned long now){
+      for (uint16_t idx = 0; idx < len; idx++){
+        _parse(buffer[idx], now);
+      }
+    }
+
+    /*
+    Reports an outstanding request as unanswered.
+    */
+    void flush(){
+      if (_pending){
+        _emitRequestOnly();
+      }
+    }
+
+    // ---GETTERS---
+
+    uint32_t requests() const {
+      return _requests;
+    }
+
+    uint32_t responses() const {
+      return _responses;
+    }
+
+    uint32_t unanswered() const {
+      return _unanswered;
+    }
+
+    bool isPending() const {
+      return _pending;
+    }
+
+  private:
+    RequestParser _request{};
+    ResponseParser _response{};
+
+    bool _pending{false};
+    SniffedTransaction _transaction{};
+
+    uint32_t _requests{0};
+    uint32_t _responses{0};
+    uint32_t _unanswered{0};
+
+    SnifferCallback _onTransaction{nullptr};
+    void* _extension{nullptr};
+
+    void _parse(uint8_t token, unsigned long now){
+      bool isRequest = _request.parse(token) == ParserState::complete;
+      ParserState response = _response.parse(token);
+      bool isResponse = response == ParserState::complete;
+
+      if (isRequest && !isResponse && _isAnswering()){
+        // a CRC match inside the payload of the expected response
+        isRequest = false;
+      }
+      if (isRequest && isResponse){
+        // valid in both directions, decided by the outstanding request
+        isRequest = !_isAnswer();
+        isResponse = !isRequest;
+      }
+      if (isRequest){
+        _onRequest(now);
+      } else if (isResponse){
+        _onResponse(now);
+      } else if (response == ParserState::exception){
+        _onException(now);
+      }
+    }
+
+    /*
+    True if the response parser holds the expected answer of the outstanding request.
+    */
+    bool _isAnswer() const {
+      if (!_pending || _response.slaveAddress() != _transaction.slave
+          || _response.functionCode() != _transaction.functionCode){
+        return false;
+      }
+      switch (_transaction.functionCode){
+        case 0x01:
+        case 0x02:
+        case 0x03:
+        case 0x04:
+          return _response.byteCount() == _expectedByteCount();
+        case 0x05:
+        case 0x06:
+          return _response.address() == _transaction.address;
+        default:
+          return _response.address() == _transaction.address && _response.quantity() == _transaction.quantity;
+      }
+    }
+
+    /*
+    True while the response parser receives the payload of the expected read response.
+    */
+    bool _isAnswering() const {
+      ParserState state = _response.state();
+      return (state == ParserState::data || state == ParserState::firstCRC || state == ParserState::secondCRC)
+          && _transaction.functionCode <= 0x04 && _isAnswer();
+    }
+
+    uint8_t _expectedByteCount() const {
+      if (_transaction.functionCode <= 0x02){
+        return (_transaction.quantity + 7) / 8;
+      }
+      return _transaction.quantity * 2;
+    }
+
+    void _onRequest(unsigned long now){
+      if (_pending){
+        _emitRequestOnly();
+      }
+      _requests++;
+      _pending = true;
+      _transaction.hasRequest = true;
+      _transaction.hasResponse = false;
+      _transaction.slave = _request.slaveAddress();
+      _transaction.functionCode = _request.functionCode();
+      _transaction.address = _request.address();
+      _transaction.quantity = _transaction.functionCode == 0x05 || _transaction.functionCode == 0x06 ? 1 : _request.quantity();
+      _transaction.exception = ErrorCode::noError;
+      _transaction.requestAt = now;
+      // realign response parser to the next frame
+      _response.reset();
+    }
+
+    void _onResponse(unsigned long now){
+      _pair(now);
+      _transaction.exception = ErrorCode::noError;
+      _emit(now, &_response);
+      _request.reset();
+    }
+
+    void _onException(unsigned long now){
+      _pair(now);
+      _transaction.exception = _response.errorCode();
+      _emit(now, nullptr);
+      _request.reset();
+      _response.reset();
+    }
+
+    /*
+    Pairs the response with the outstanding request.
+    A response of another slave or function code starts a transaction without request.
+    */
+    void _pair(unsigned long now){
+      _responses++;
+      bool paired = _pending && _response.slaveAddress() == _transaction.slave
+                 && _response.functionCode() == _transaction.functionCode;
+      if (!paired){
+        if (_pending){
+          _emitRequestOnly();
+        }
+        _transaction.hasRequest = false;
+        _transaction.slave = _response.slaveAddress();
+        _transaction.functionCode = _response.functionCode();
+        bool hasAddress = _transaction.functionCode > 0x04 && !_response.isException();
+        _transaction.address = hasAddress ? _response.address() : 0;
+        _transaction.quantity = hasAddress ? _response.quantity() : 0;
+        _transaction.requestAt = now;
+      }
+      _transaction.hasResponse = true;
+    }
+
+    void _emitRequestOnly(){
+      _unanswered++;
+      _transaction.hasResponse = false;
+      _emit(_transaction.requestAt, nullptr);
+    }
+
+    void _emit(unsigned long now, ResponseParser *response){
+      _pending = false;
+      _transaction.responseAt = now;
+      _transaction.latency = now - _transaction.requestAt;
+      if (_onTransaction){
+        _onTransaction(this, _transaction, response);
+      }
+    }
+};
+
+#endif
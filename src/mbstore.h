@@ -0,0 +1,441 @@
+/*
+mbstore.h
+
+Contains:
+Definition of SampleStore, an append only columnar store of polled register values.
+
+Remarks:
+A series is the result of one poll request: slave, function code, address and quantity.
+Each poll appends one row: a timestamp and quantity register words.
+
+The store works on memory given by the user, e.g. a static array or a memory mapped file.
+The memory starts with a superblock: magic, version, geometry, the ring position and the
+series table. The rest is split into blocks of MBSTORE_BLOCK_SIZE bytes. A block belongs to
+one series and holds its rows column wise: a time column followed by one column per register.
+Blocks are used as a ring, when the memory is full the oldest block is overwritten.
+begin formats the memory, attach reuses the store found in memory, e.g. after a restart.
+The layout depends on the compiler and the byte order, a store is not portable between
+platforms.
+
+Timestamps are 64 bit, e.g. milliseconds since the epoch. Each block keeps its first and last
+timestamp, the rows are stored as 16 bit deltas to the first timestamp of the block.
+With delta encoding a register column holds 8 bit deltas to the first row of the block,
+which halves the columns of slowly changing values. A row which does not fit starts a new block.
+
+Append is a few stores per register without allocation. A scan skips blocks by their series
+and time range and reads the columns sequentially.
+
+The block size and the number of series are fixed at compile time and can be changed with
+-D MBSTORE_BLOCK_SIZE=n and -D MBSTORE_MAX_SERIES=n
+*/
+#ifndef mbstore_h
+#define mbstore_h
+
+#include "mbparser.h"
+#include "mbframe.h"
+
+#ifndef MBSTORE_BLOCK_SIZE
+#define MBSTORE_BLOCK_SIZE 256
+#endif
+
+#ifndef MBSTORE_MAX_SERIES
+#define MBSTORE_MAX_SERIES 16
+#endif
+
+#define MBSTORE_NO_BLOCK 0xFFFF
+#define MBSTORE_MAGIC 0x5453424D // "MBST"
+#define MBSTORE_VERSION 1
+
+class SampleStore;
+
+#ifdef STD_FUNCTIONAL
+  typedef std::function<void(SampleStore *store, uint8_t series, uint64_t timestamp, const uint16_t *values, uint16_t quantity)> ScanCallback;
+#else
+  typedef void(*ScanCallback)(SampleStore *store, uint8_t series, uint64_t timestamp, const uint16_t *values, uint16_t quantity);
+#endif
+
+class SampleStore{
+  public:
+    SampleStore(){};
+    SampleStore(const SampleStore&) = delete;
+    SampleStore& operator= (const SampleStore&) = delete;
+
+    /*
+    Formats memory of size bytes as empty store without series.
+    memory must be aligned to 8 bytes.
+    Returns false if memory holds no block besides the superblock.
+    */
+    bool begin(uint8_t *memory, size_t size){
+      uint32_t blocks = _dataBlocks(size);
+      if (blocks == 0 || blocks >= MBSTORE_NO_BLOCK){
+        _detach();
+        return false;
+      }
+      _map(memory);
+      memset(_super, 0, sizeof(Superblock));
+      _super->blockSize = MBSTORE_BLOCK_SIZE;
+      _super->maxSeries = MBSTORE_MAX_SERIES;
+      _super->blocks = blocks;
+      _super->version = MBSTORE_VERSION;
+      _super->magic = MBSTORE_MAGIC;
+      return true;
+    }
+
+    /*
+    Reuses the store formatted by begin in memory of size bytes, with its series and rows.
+    Checks the superblock, the series table and the headers of the used blocks.
+    Returns false if memory holds no valid store of this size, block size and series limit.
+    Call begin then.
+    */
+    bool attach(uint8_t *memory, size_t size){
+      const Superblock *super = reinterpret_cast<const Superblock*>(memory);
+      if (_dataBlocks(size) == 0 || super->magic != MBSTORE_MAGIC || super->version != MBSTORE_VERSION
+          || super->blockSize != MBSTORE_BLOCK_SIZE || super->maxSeries != MBSTORE_MAX_SERIES
+          || super->blocks != _dataBlocks(size) || super->head >= super->blocks
+          || super->used > super->blocks || super->seriesCount > MBSTORE_MAX_SERIES){
+        _detach();
+        return false;
+      }
+      _map(memory);
+      if (!_isConsistent()){
+        _detach();
+        return false;
+      }
+      return true;
+    }
+
+    /*
+    Adds a series of registers.
+    Returns the series id or -1 if the series does not fit into a block or too many series exist.
+    */
+    int8_t addSeries(uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity, bool delta = false){
+      if (!_super || _super->seriesCount == MBSTORE_MAX_SERIES || quantity == 0 || quantity > MB_MAX_READ_REGISTERS
+          || sizeof(BlockHeader) + 4 * quantity + 2 > MBSTORE_BLOCK_SIZE){
+        return -1;
+      }
+      Series &series = _super->series[_super->seriesCount];
+      series.slave = slave;
+      series.functionCode = fc;
+      series.address = address;
+      series.quantity = quantity;
+      series.delta = delta;
+      series.reserved = 0;
+      series.block = MBSTORE_NO_BLOCK;
+      series.rows = 0;
+      series.capacity = _capacity(quantity, delta);
+      if (series.capacity == 0){
+        return -1;
+      }
+      return _super->seriesCount++;
+    }
+
+    /*
+    Appends a row of registers in modbus byte order.
+    */
+    bool append(uint8_t id, uint64_t timestamp, const uint8_t *data){
+      if (id >= series()){
+        return false;
+      }
+      Series &series = _super->series[id];
+      uint16_t values[MB_MAX_READ_REGISTERS];
+      for (uint16_t idx = 0; idx < series.quantity; idx++){
+        values[idx] = ModbusFrame::getWord(data + 2 * idx);
+      }
+      if (!_fits(series, timestamp, values)){
+        _open(id, timestamp, values);
+      }
+      _write(series, timestamp, values);
+      series.rows++;
+      return true;
+    }
+
+    /*
+    Appends the payload of a completed FC03 or FC04 response.
+    */
+    bool append(uint8_t id, uint64_t timestamp, const ResponseParser &parser){
+      if (id >= series() || !parser.isComplete() || parser.functionCode() != _super->series[id].functionCode
+          || parser.byteCount() != 2 * _super->series[id].quantity || parser.data() == nullptr){
+        return false;
+      }
+      return append(id, timestamp, parser.data());
+    }
+
+    /*
+    Calls cb for each row of series with from <= timestamp <= to, oldest first.
+    Returns the number of rows.
+    */
+    uint32_t scan(uint8_t id, uint64_t from, uint64_t to, ScanCallback cb){
+      if (id >= series()){
+        return 0;
+      }
+      const Series &series = _super->series[id];
+      uint16_t values[MB_MAX_READ_REGISTERS];
+      uint32_t count = 0;
+      uint16_t blocks = _super->blocks;
+      for (uint16_t step = 0; step < _super->used; step++){
+        uint16_t idx = (_super->head + blocks - _super->used + step) % blocks;
+        const BlockHeader &header = _header(idx);
+        if (header.series != id || header.lastTime < from || header.baseTime > to){
+          continue;
+        }
+        const uint16_t *times = _times(idx);
+        for (uint16_t row = 0; row < header.rows; row++){
+          uint64_t timestamp = header.baseTime + times[row];
+          if (timestamp >= from && timestamp <= to){
+            _read(series, idx, row, values);
+            count++;
+            if (cb){
+              cb(this, id, timestamp, values, series.quantity);
+            }
+          }
+        }
+      }
+      return count;
+    }
+
+    /*
+    Sets void pointer to keep reference to third party objects.
+    */
+    void setExtension(void* ptr){
+      _extension = ptr;
+    }
+
+    void* getExtension(){
+      return _extension;
+    }
+
+    // ---GETTERS---
+
+    /*
+    Data blocks, without the superblock.
+    */
+    uint16_t blocks() const {
+      return _super ? _super->blocks : 0;
+    }
+
+    uint16_t usedBlocks() const {
+      return _super ? _super->used : 0;
+    }
+
+    uint8_t series() const {
+      return _super ? _super->seriesCount : 0;
+    }
+
+    /*
+    Rows a block of the series holds.
+    */
+    uint16_t capacity(uint8_t id) const {
+      return _super->series[id].capacity;
+    }
+
+    /*
+    Rows appended to the series, including overwritten rows.
+    */
+    uint32_t rows(uint8_t id) const {
+      return _super->series[id].rows;
+    }
+
+  private:
+    struct BlockHeader{
+      uint8_t series;
+      uint8_t reserved;
+      uint16_t rows;
+      uint32_t reserved2;
+      uint64_t baseTime;
+      uint64_t lastTime;
+    };
+
+    struct Series{
+      uint8_t slave;
+      uint8_t functionCode;
+      uint16_t address;
+      uint16_t quantity;
+      uint16_t capacity;
+      uint16_t block; // open block
+      uint8_t delta;
+      uint8_t reserved;
+      uint32_t rows;
+    };
+
+    struct Superblock{
+      uint32_t magic;
+      uint16_t version;
+      uint16_t blockSize;
+      uint16_t blocks;
+      uint16_t head;
+      uint16_t used;
+      uint8_t maxSeries;
+      uint8_t seriesCount;
+      Series series[MBSTORE_MAX_SERIES];
+    };
+
+    // the superblock takes whole blocks, so data blocks stay aligned
+    static const size_t _superSize{(sizeof(Superblock) + MBSTORE_BLOCK_SIZE - 1) / MBSTORE_BLOCK_SIZE * MBSTORE_BLOCK_SIZE};
+
+    Superblock *_super{nullptr};
+    uint8_t *_memory{nullptr}; // first data block
+
+    void* _extension{nullptr};
+
+    static uint32_t _dataBlocks(size_t size){
+      return size > _superSize ? (size - _superSize) / MBSTORE_BLOCK_SIZE : 0;
+    }
+
+    void _map(uint8_t *memory){
+      _super = reinterpret_cast<Superblock*>(memory);
+      _memory = memory + _superSize;
+    }
+
+    void _detach(){
+      _super = nullptr;
+      _memory = nullptr;
+    }
+
+    static uint16_t _capacity(uint16_t quantity, bool delta){
+      if (delta){
+        return (MBSTORE_BLOCK_SIZE - sizeof(BlockHeader) - 2 * quantity) / (2 + quantity);
+      }
+      return (MBSTORE_BLOCK_SIZE - sizeof(BlockHeader)) / (2 + 2 * quantity);
+    }
+
+    /*
+    Position of block idx in the ring, the oldest used block is 0.
+    */
+    uint16_t _age(uint16_t idx) const {
+      return (idx + _super->blocks + _super->used - _super->head) % _super->blocks;
+    }
+
+    /*
+    Checks what scan and append index with: the series table against the block size
+    and the used blocks, the used block headers against the series table.
+    */
+    bool _isConsistent() const {
+      for (uint8_t id = 0; id < _super->seriesCount; id++){
+        const Series &series = _super->series[id];
+        if (series.quantity == 0 || series.quantity > MB_MAX_READ_REGISTERS || series.delta > 1
+            || sizeof(BlockHeader) + 4 * series.quantity + 2 > MBSTORE_BLOCK_SIZE
+            || series.capacity != _capacity(series.quantity, series.delta)){
+          return false;
+        }
+        if (series.block != MBSTORE_NO_BLOCK && (series.block >= _super->blocks
+            || _age(series.block) >= _super->used || _header(series.block).series != id)){
+          return false;
+        }
+      }
+      for (uint16_t step = 0; step < _super->used; step++){
+        const BlockHeader &header = _header((_super->head + _super->blocks - _super->used + step) % _super->blocks);
+        if (header.series >= _super->seriesCount || header.rows > _super->series[header.series].capacity
+            || header.lastTime < header.baseTime){
+          return false;
+        }
+      }
+      return true;
+    }
+
+    BlockHeader& _header(uint16_t idx) const {
+      return *reinterpret_cast<BlockHeader*>(_memory + idx * MBSTORE_BLOCK_SIZE);
+    }
+
+    uint16_t* _base(uint16_t idx) const {
+      return reinterpret_cast<uint16_t*>(_memory + idx * MBSTORE_BLOCK_SIZE + sizeof(BlockHeader));
+    }
+
+    uint16_t* _times(uint16_t idx) const {
+      const Series &series = _super->series[_header(idx).series];
+      return _base(idx) + (series.delta ? series.quantity : 0);
+    }
+
+    uint8_t* _columns(uint16_t idx) const {
+      const Series &series = _super->series[_header(idx).series];
+      return reinterpret_cast<uint8_t*>(_times(idx) + series.capacity);
+    }
+
+    bool _fits(const Series &series, uint64_t timestamp, const uint16_t *values) const {
+      if (series.block == MBSTORE_NO_BLOCK){
+        return false;
+      }
+      const BlockHeader &header = _header(series.block);
+      if (header.rows == series.capacity || timestamp - header.baseTime > 0xFFFF || timestamp < header.lastTime){
+        return false;
+      }
+      if (series.delta){
+        const uint16_t *base = _base(series.block);
+        for (uint16_t idx = 0; idx < series.quantity; idx++){
+          int16_t delta = int16_t(values[idx] - base[idx]);
+          if (delta < -128 || delta > 127){
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+
+    /*
+    Takes the next block of the ring for series id.
+    */
+    void _open(uint8_t id, uint64_t timestamp, const uint16_t *values){
+      uint16_t idx = _super->head;
+      _super->head = (idx + 1) % _super->blocks;
+      if (_super->used < _super->blocks){
+        _super->used++;
+      } else {
+        // overwrite the oldest block
+        Series &owner = _super->series[_header(idx).series];
+        if (owner.block == idx){
+          owner.block = MBSTORE_NO_BLOCK;
+        }
+      }
+      Series &series = _super->series[id];
+      series.block = idx;
+      BlockHeader &header = _header(idx);
+      header.series = id;
+      header.reserved = 0;
+      header.reserved2 = 0;
+      header.rows = 0;
+      header.baseTime = timestamp;
+      header.lastTime = timestamp;
+      if (series.delta){
+        memcpy(_base(idx), values, 2 * series.quantity);
+      }
+    }
+
+    void _write(Series &series, uint64_t timestamp, const uint16_t *values){
+      uint16_t idx = series.block;
+      BlockHeader &header = _header(idx);
+      uint16_t row = header.rows;
+      _times(idx)[row] = timestamp - header.baseTime;
+      uint8_t *columns = _columns(idx);
+      if (series.delta){
+        int8_t *column = reinterpret_cast<int8_t*>(columns);
+        const uint16_t *base = _base(idx);
+        for (uint16_t reg = 0; reg < series.quantity; reg++){
+          column[reg * series.capacity + row] = int8_t(values[reg] - base[reg]);
+        }
+      } else {
+        uint16_t *column = reinterpret_cast<uint16_t*>(columns);
+        for (uint16_t reg = 0; reg < series.quantity; reg++){
+          column[reg * series.capacity + row] = values[reg];
+        }
+      }
+      header.lastTime = timestamp;
+      header.rows = row + 1;
+    }
+
+    void _read(const Series &series, uint16_t idx, uint16_t row, uint16_t *values) const {
+      const uint8_t *columns = _columns(idx);
+      if (series.delta){
+        const int8_t *column = reinterpret_cast<const int8_t*>(columns);
+        const uint16_t *base = _base(idx);
+        for (uint16_t reg = 0; reg < series.quantity; reg++){
+          values[reg] = base[reg] + column[reg * series.capacity + row];
+        }
+      } else {
+        const uint16_t *column = reinterpret_cast<const uint16_t*>(columns);
+        for (uint16_t reg = 0; reg < series.quantity; reg++){
+          values[reg] = column[reg * series.capacity + row];
+        }
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,387 @@
+/*
+mbtcpclient.h
+
+Contains:
+Definition of ModbusTCPClient, a pipelined modbus TCP client.
+
+Remarks:
+Modbus TCP allows several requests in flight on one connection, correlated by the
+transaction id of the MBAP header. The client keeps up to window requests outstanding
+and completes each transaction when its response arrives, in any order.
+Requests exceeding the window are queued and send as soon as a transaction completes.
+
+Responses are parsed by a ResponseParser, so the user gets the same interface as on RTU.
+The client does not own the connection. The user feeds received bytes and provides a writer.
+
+An invalid MBAP header means the stream is out of sync. All transactions are failed,
+received bytes are ignored and no request is accepted until reset() is called,
+typically after the connection is reopened.
+
+The number of transactions is fixed at compile time and can be changed with
+-D MBTCPCLIENT_MAX_TRANSACTIONS=n
+*/
+#ifndef mbtcpclient_h
+#define mbtcpclient_h
+
+#include "mbparser.h"
+#include "mbframe.h"
+
+#ifndef MBTCPCLIENT_MAX_TRANSACTIONS
+#define MBTCPCLIENT_MAX_TRANSACTIONS 8
+#endif
+
+class ModbusTCPClient;
+
+#ifdef STD_FUNCTIONAL
+  typedef std::function<void(ModbusTCPClient *client, const uint8_t *adu, uint16_t len)> TCPClientWriter;
+  typedef std::function<void(ModbusTCPClient *client, uint16_t transactionId, ResponseParser *parser)> TransactionCallback;
+#else
+  typedef void(*TCPClientWriter)(ModbusTCPClient *client, const uint8_t *adu, uint16_t len);
+  typedef void(*TransactionCallback)(ModbusTCPClient *client, uint16_t transactionId, ResponseParser *parser);
+#endif
+
+/*
+Why a transaction ended without parser.
+*/
+enum class TransactionFailure{
+  none = 0,
+  timeout = 1,
+  malformedResponse = 2, // MBAP length does not match the PDU
+  syncLost = 3
+};
+
+/*
+Pipelined modbus TCP client.
+Every request returns its transaction id or -1 if no transaction is free.
+The transaction callback is called once per transaction:
+with a complete parser, with a parser in exception state (modbus exception),
+with a parser in error state or with nullptr if there is no valid response.
+Within the callback failure() tells why the parser is nullptr.
+*/
+class ModbusTCPClient{
+  public:
+    ModbusTCPClient(){
+      _parser.setByteCountLimit(MB_MAX_PDU - 2);
+    };
+    ModbusTCPClient(const ModbusTCPClient&) = delete;
+    ModbusTCPClient& operator= (const ModbusTCPClient&) = delete;
+
+    /*
+    Sets writer to send an ADU on the connection.
+    */
+    void setWriter(TCPClientWriter cb){
+      _writer = cb;
+    }
+
+    /*
+    Sets callback which is called when a transaction has finished.
+    */
+    void setOnTransactionCB(TransactionCallback cb){
+      _onTransaction = cb;
+    }
+
+    /*
+    Sets the number of requests in flight.
+    Default is MBTCPCLIENT_MAX_TRANSACTIONS. Window 1 is stop and wait.
+    */
+    void setWindow(uint8_t window){
+      _window = max(uint8_t(1), min(window, uint8_t(MBTCPCLIENT_MAX_TRANSACTIONS)));
+    }
+
+    /*
+    Sets the time a transaction waits for its response.
+    Default is 1000 ms.
+    */
+    void setTimeout(unsigned long timeout){
+      _timeout = timeout;
+    }
+
+    /*
+    Sets void pointer to keep reference to third party objects.
+    */
+    void setExtension(void* ptr){
+      _extension = ptr;
+    }
+
+    void* getExtension(){
+      return _extension;
+    }
+
+    /*
+    Requests a FC01, FC02, FC03 or FC04 read.
+    */
+    int32_t read(uint8_t unit, uint8_t fc, uint16_t address, uint16_t quantity, unsigned long now){
+      uint8_t rtu[8];
+      uint16_t len = ModbusFrame::readRequest(rtu, unit, fc, address, quantity);
+      return _request(rtu, len, now);
+    }
+
+    /*
+    Requests a FC05 or FC06 write.
+    */
+    int32_t writeSingle(uint8_t unit, uint8_t fc, uint16_t address, uint16_t value, unsigned long now){
+      uint8_t rtu[8];
+      uint16_t len = ModbusFrame::writeSingle(rtu, unit, fc, address, value);
+      return _request(rtu, len, now);
+    }
+
+    /*
+    Requests a FC15 or FC16 write. data must be in modbus byte order.
+    */
+    int32_t writeMultiple(uint8_t unit, uint8_t fc, uint16_t address, uint16_t quantity,
+                          const uint8_t *data, uint8_t byteCount, unsigned long now){
+      if (byteCount > MB_MAX_PDU - 6){
+        return -1;
+      }
+      uint8_t rtu[MB_RTU_MAX_ADU];
+      uint16_t len = ModbusFrame::writeMultiple(rtu, unit, fc, address, quantity, data, byteCount);
+      return _request(rtu, len, now);
+    }
+
+    /*
+    Parses bytes received on the connection.
+    Responses may arrive in any order.
+    */
+    void parse(const uint8_t *buffer, uint16_t len, unsigned long now){
+      _now = now;
+      uint16_t index = 0;
+      while (index < len && !_syncLost){
+        uint16_t expected = _rxLen < MB_MBAP_SIZE ? MB_MBAP_SIZE : _header.length + 6;
+        uint16_t chunk = min(uint16_t(expected - _rxLen), uint16_t(len - index));
+        memcpy(_rx + _rxLen, buffer + index, chunk);
+        _rxLen += chunk;
+        index += chunk;
+        if (_rxLen == MB_MBAP_SIZE){
+          if (!ModbusFrame::readMBAP(_rx, _rxLen, _header)){
+            _loseSync();
+          }
+        } else if (_rxLen == expected){
+          _deliver();
+          _rxLen = 0;
+        }
+      }
+    }
+
+    /*
+    Checks outstanding transactions for timeouts.
+    */
+    void poll(unsigned long now){
+      _now = now;
+      for (uint8_t idx = 0; idx < MBTCPCLIENT_MAX_TRANSACTIONS; idx++){
+        Transaction &transaction = _transactions[idx];
+        if (transaction.state == TransactionState::inFlight && _now - transaction.sentAt >= _timeout){
+          _fail(transaction, TransactionFailure::timeout);
+        }
+      }
+    }
+
+    /*
+    Clears all transactions, the receive buffer and a lost sync, e.g. after reconnect.
+    Pending transactions are not reported.
+    */
+    void reset(){
+      for (uint8_t idx = 0; idx < MBTCPCLIENT_MAX_TRANSACTIONS; idx++){
+        _transactions[idx].state = TransactionState::free;
+      }
+      _inFlight = 0;
+      _rxLen = 0;
+      _syncLost = false;
+    }
+
+    // ---GETTERS---
+
+    uint8_t inFlight() const {
+      return _inFlight;
+    }
+
+    uint8_t queued() const {
+      uint8_t count = 0;
+      for (uint8_t idx = 0; idx < MBTCPCLIENT_MAX_TRANSACTIONS; idx++){
+        count += _transactions[idx].state == TransactionState::queued;
+      }
+      return count;
+    }
+
+    uint8_t window() const {
+      return _window;
+    }
+
+    uint32_t syncErrors() const {
+      return _syncErrors;
+    }
+
+    /*
+    True after an invalid MBAP header until reset().
+    */
+    bool isSyncLost() const {
+      return _syncLost;
+    }
+
+    /*
+    Why the current transaction ended without parser. Valid within the transaction callback.
+    */
+    TransactionFailure failure() const {
+      return _failure;
+    }
+
+  private:
+    enum class TransactionState{
+      free = 0,
+      queued = 1,
+      inFlight = 2
+    };
+
+    struct Transaction{
+      TransactionState state{TransactionState::free};
+      uint16_t id{0};
+      uint8_t unit{0};
+      uint8_t functionCode{0};
+      uint16_t len{0};
+      unsigned long sentAt{0};
+      uint8_t adu[MB_TCP_MAX_ADU];
+    };
+
+    Transaction _transactions[MBTCPCLIENT_MAX_TRANSACTIONS];
+    uint8_t _window{MBTCPCLIENT_MAX_TRANSACTIONS};
+    uint8_t _inFlight{0};
+    uint16_t _nextId{1};
+
+    ResponseParser _parser{};
+    MBAPHeader _header{};
+    uint8_t _rx[MB_TCP_MAX_ADU];
+    uint16_t _rxLen{0};
+    uint8_t _rtu[MB_RTU_MAX_ADU];
+    uint32_t _syncErrors{0};
+    bool _syncLost{false};
+    TransactionFailure _failure{TransactionFailure::none};
+
+    TCPClientWriter _writer{nullptr};
+    TransactionCallback _onTransaction{nullptr};
+    unsigned long _timeout{1000};
+    unsigned long _now{0};
+    void* _extension{nullptr};
+
+    int32_t _request(const uint8_t *rtu, uint16_t len, unsigned long now){
+      _now = now;
+      if (_syncLost){
+        return -1;
+      }
+      Transaction *transaction = nullptr;
+      for (uint8_t idx = 0; idx < MBTCPCLIENT_MAX_TRANSACTIONS; idx++){
+        if (_transactions[idx].state == TransactionState::free){
+          transaction = &_transactions[idx];
+          break;
+        }
+      }
+      if (!transaction){
+        return -1;
+      }
+      transaction->id = _nextId++;
+      transaction->unit = rtu[0];
+      transaction->functionCode = rtu[1];
+      transaction->len = ModbusFrame::rtuToTCP(transaction->adu, rtu, len, transaction->id);
+      transaction->state = TransactionState::queued;
+      _send();
+      return transaction->id;
+    }
+
+    /*
+    Sends queued transactions in order of their ids while the window allows.
+    */
+    void _send(){
+      while (_inFlight < _window){
+        Transaction *next = nullptr;
+        for (uint8_t idx = 0; idx < MBTCPCLIENT_MAX_TRANSACTIONS; idx++){
+          Transaction &transaction = _transactions[idx];
+          if (transaction.state == TransactionState::queued
+              && (!next || uint16_t(transaction.id - next->id) > 0x8000)){
+            next = &transaction;
+          }
+        }
+        if (!next){
+          return;
+        }
+        next->state = TransactionState::inFlight;
+        next->sentAt = _now;
+        _inFlight++;
+        if (_writer){
+          _writer(this, next->adu, next->len);
+        }
+      }
+    }
+
+    void _deliver(){
+      Transaction *transaction = nullptr;
+      for (uint8_t idx = 0; idx < MBTCPCLIENT_MAX_TRANSACTIONS; idx++){
+        if (_transactions[idx].state == TransactionState::inFlight && _transactions[idx].id == _header.transactionId){
+          transaction = &_transactions[idx];
+          break;
+        }
+      }
+      uint8_t fc = _rx[MB_MBAP_SIZE] & 0x7F;
+      if (!transaction || transaction->unit != _header.unitId || transaction->functionCode != fc){
+        // stale or foreign response
+        return;
+      }
+      // feed the response as RTU frame, so the user gets the usual parser interface
+      _rtu[0] = _header.unitId;
+      memcpy(_rtu + 1, _rx + MB_MBAP_SIZE, _header.length - 1);
+      uint16_t len = ModbusFrame::appendCRC(_rtu, _header.length);
+      _parser.reset();
+      _parser.setSlaveAddress(_header.unitId);
+      // parse token by token, the parser starts over after a frame ended
+      uint16_t consumed = 0;
+      ParserState state = ParserState::slaveAddress;
+      while (consumed < len && !_isTerminal(state)){
+        state = _parser.parse(_rtu[consumed++]);
+      }
+      bool isResponse = consumed == len && (state == ParserState::complete || state == ParserState::exception);
+      // the CRC is ours, a CRC error means the PDU ends elsewhere than the MBAP length says
+      bool isParserError = state == ParserState::error && _parser.errorCode() != ErrorCode::CRCError;
+      if (!isResponse && !isParserError){
+        _fail(*transaction, TransactionFailure::malformedResponse);
+        return;
+      }
+      _finish(*transaction, &_parser);
+    }
+
+    static bool _isTerminal(ParserState state){
+      return state == ParserState::complete || state == ParserState::exception || state == ParserState::error;
+    }
+
+    /*
+    Fails all transactions, the position of the next MBAP header is unknown.
+    */
+    void _loseSync(){
+      _rxLen = 0;
+      _syncErrors++;
+      _syncLost = true;
+      for (uint8_t idx = 0; idx < MBTCPCLIENT_MAX_TRANSACTIONS; idx++){
+        if (_transactions[idx].state != TransactionState::free){
+          _fail(_transactions[idx], TransactionFailure::syncLost);
+        }
+      }
+    }
+
+    void _fail(Transaction &transaction, TransactionFailure failure){
+      _failure = failure;
+      _finish(transaction, nullptr);
+      _failure = TransactionFailure::none;
+    }
+
+    void _finish(Transaction &transaction, ResponseParser *parser){
+      uint16_t id = transaction.id;
+      if (transaction.state == TransactionState::inFlight){
+        _inFlight--;
+      }
+      transaction.state = TransactionState::free;
+      if (_onTransaction){
+        _onTransaction(this, id, parser);
+      }
+      if (!_syncLost){
+        _send();
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,329 @@
+/*
+mbwrite.h
+
+Contains:
+Definition of WriteCoalescer, which merges single writes of one cycle into FC15/FC16 requests.
+Definition of WriteRequest, one planned write request.
+
+Remarks:
+Control logic stages FC05 and FC06 writes with write(). plan() sorts them per slave and table
+and merges adjacent addresses into one FC15 or FC16 request. Several writes to the same address
+are merged as well, the value written last wins. A request never exceeds the write limits of
+modbus nor the byte count limit of the slave. A run of one address stays a FC05 or FC06 request.
+
+When the response of a request is complete, complete() calls the write callback of each write
+merged into the request, with noError or the exception code of the slave.
+The order of writes to different addresses within one cycle is not preserved.
+
+Capacities are fixed at compile time and can be changed with
+-D MBWRITE_MAX_WRITES=n and -D MBWRITE_MAX_REQUESTS=n
+*/
+#ifndef mbwrite_h
+#define mbwrite_h
+
+#include "mbparser.h"
+#include "mbframe.h"
+#include "mbbits.h"
+
+#ifndef MBWRITE_MAX_WRITES
+#define MBWRITE_MAX_WRITES 32
+#endif
+
+#ifndef MBWRITE_MAX_REQUESTS
+#define MBWRITE_MAX_REQUESTS 8
+#endif
+
+class WriteCoalescer;
+
+#ifdef STD_FUNCTIONAL
+  typedef std::function<void(WriteCoalescer *coalescer, uint8_t write, ErrorCode code)> WriteCallback;
+#else
+  typedef void(*WriteCallback)(WriteCoalescer *coalescer, uint8_t write, ErrorCode code);
+#endif
+
+/*
+A planned write request.
+first and last are positions in planned order of the writes merged into the request.
+*/
+struct WriteRequest{
+  uint8_t slave;
+  uint8_t functionCode; // FC05, FC06, FC15 or FC16
+  uint16_t address;
+  uint16_t quantity;
+  uint8_t first;
+  uint8_t last;
+  bool done;
+};
+
+class WriteCoalescer{
+  public:
+    WriteCoalescer(){};
+    WriteCoalescer(const WriteCoalescer&) = delete;
+    WriteCoalescer& operator= (const WriteCoalescer&) = delete;
+
+    /*
+    Stages a FC05 or FC06 write.
+    For FC05 any value but zero switches the coil on.
+    cb is called once the request containing the write is completed.
+    Returns the write id or -1 when full or invalid.
+    The plan is invalid after staging a write.
+    */
+    int16_t write(uint8_t slave, uint8_t fc, uint16_t address, uint16_t value, WriteCallback cb = nullptr){
+      if (_writeCount >= MBWRITE_MAX_WRITES || (fc != 0x05 && fc != 0x06)){
+        return -1;
+      }
+      Write &write = _writes[_writeCount];
+      write.slave = slave;
+      write.functionCode = fc;
+      write.address = address;
+      write.value = fc == 0x05 && value ? 0xFF00 : value;
+      write.onComplete = cb;
+      _requestCount = 0;
+      return _writeCount++;
+    }
+
+    /*
+    Removes all writes and the plan. Call when a cycle is done.
+    */
+    void clear(){
+      _writeCount = 0;
+      _requestCount = 0;
+    }
+
+    /*
+    Sets limit for the payload of one request.
+    Should match the byte count limit of the slaves.
+    The default limit is 96 bytes.
+    */
+    void setByteCountLimit(size_t size){
+      _byteCountLimit = size;
+    }
+
+    /*
+    Sets void pointer to keep reference to third party objects.
+    */
+    void setExtension(void* ptr){
+      _extension = ptr;
+    }
+
+    void* getExtension(){
+      return _extension;
+    }
+
+    /*
+    Builds the request set.
+    Returns the number of requests, zero without staged writes
+    or -1 if the plan does not fit into MBWRITE_MAX_REQUESTS.
+    */
+    int16_t plan(){
+      _requestCount = 0;
+      _sort();
+      uint8_t pos = 0;
+      while (pos < _writeCount){
+        const Write &write = _writes[_order[pos]];
+        uint16_t maxQuantity = _maxQuantity(write.functionCode);
+        uint8_t first = pos;
+        uint32_t start = write.address;
+        uint32_t end = write.address;
+        for (pos++; pos < _writeCount; pos++){
+          const Write &next = _writes[_order[pos]];
+          if (!_sameKey(write, next) || next.address > end + 1 || next.address - start + 1 > maxQuantity){
+            break;
+          }
+          end = next.address;
+        }
+        if (!_emit(first, pos - 1, start, end)){
+          return -1;
+        }
+      }
+      return _requestCount;
+    }
+
+    /*
+    Builds the RTU frame of request idx into buffer.
+    Returns the frame length.
+    */
+    uint16_t request(uint8_t idx, uint8_t *buffer) const {
+      const WriteRequest &request = _requests[idx];
+      if (request.functionCode == 0x05 || request.functionCode == 0x06){
+        return ModbusFrame::writeSingle(buffer, request.slave, request.functionCode, request.address,
+            _writes[_order[request.last]].value);
+      }
+      uint8_t data[2 * MB_MAX_WRITE_REGISTERS];
+      uint8_t byteCount;
+      if (request.functionCode == 0x0F){
+        byteCount = (request.quantity + 7) / 8;
+        memset(data, 0, byteCount);
+        for (uint8_t pos = request.first; pos <= request.last; pos++){
+          const Write &write = _writes[_order[pos]];
+          ModbusBits::setBit(data, write.address - request.address, write.value != 0);
+        }
+      } else {
+        byteCount = 2 * request.quantity;
+        for (uint8_t pos = request.first; pos <= request.last; pos++){
+          const Write &write = _writes[_order[pos]];
+          data[2 * (write.address - request.address)] = highByte(write.value);
+          data[2 * (write.address - request.address) + 1] = lowByte(write.value);
+        }
+      }
+      return ModbusFrame::writeMultiple(buffer, request.slave, request.functionCode, request.address,
+          request.quantity, data, byteCount);
+    }
+
+    /*
+    Maps a completed or exception response of request idx back to the writes.
+    Calls the write callback of each merged write.
+    An exception with code zero is reported as slaveDeviceFailure.
+    Returns false if the response does not belong to the request,
+    e.g. a FC05 or FC06 echo with another value.
+    */
+    bool complete(uint8_t idx, const ResponseParser &parser){
+      if (idx >= _requestCount || (!parser.isComplete() && !parser.isException())){
+        return false;
+      }
+      const WriteRequest &request = _requests[idx];
+      if (parser.slaveAddress() != request.slave || parser.functionCode() != request.functionCode){
+        return false;
+      }
+      if (parser.isException()){
+        ErrorCode code = parser.errorCode();
+        _finish(idx, code == ErrorCode::noError ? ErrorCode::slaveDeviceFailure : code);
+        return true;
+      }
+      if (parser.address() != request.address){
+        return false;
+      }
+      if (request.functionCode == 0x05 || request.functionCode == 0x06){
+        if (parser.data() == nullptr || ModbusFrame::getWord(parser.data()) != _writes[_order[request.last]].value){
+          return false;
+        }
+      } else if (parser.quantity() != request.quantity){
+        return false;
+      }
+      _finish(idx, ErrorCode::noError);
+      return true;
+    }
+
+    /*
+    Fails request idx with code, e.g. gatewayTargetFailed on a timeout.
+    */
+    void fail(uint8_t idx, ErrorCode code){
+      if (idx < _requestCount){
+        _finish(idx, code);
+      }
+    }
+
+    // ---GETTERS---
+
+    uint8_t requests() const {
+      return _requestCount;
+    }
+
+    const WriteRequest& request(uint8_t idx) const {
+      return _requests[idx];
+    }
+
+    uint8_t writes() const {
+      return _writeCount;
+    }
+
+    /*
+    Planned requests which are not completed yet.
+    */
+    uint8_t pending() const {
+      uint8_t count = 0;
+      for (uint8_t idx = 0; idx < _requestCount; idx++){
+        count += !_requests[idx].done;
+      }
+      return count;
+    }
+
+  private:
+    struct Write{
+      uint8_t slave;
+      uint8_t functionCode;
+      uint16_t address;
+      uint16_t value;
+      WriteCallback onComplete;
+    };
+
+    Write _writes[MBWRITE_MAX_WRITES];
+    uint8_t _order[MBWRITE_MAX_WRITES];
+    uint8_t _writeCount{0};
+
+    WriteRequest _requests[MBWRITE_MAX_REQUESTS];
+    uint8_t _requestCount{0};
+
+    size_t _byteCountLimit{96};
+
+    void* _extension{nullptr};
+
+    uint16_t _maxQuantity(uint8_t fc) const {
+      if (fc == 0x05){
+        return min(size_t(MB_MAX_WRITE_BITS), _byteCountLimit * 8);
+      }
+      return min(size_t(MB_MAX_WRITE_REGISTERS), _byteCountLimit / 2);
+    }
+
+    static bool _sameKey(const Write &a, const Write &b){
+      return a.slave == b.slave && a.functionCode == b.functionCode;
+    }
+
+    static bool _less(const Write &a, const Write &b){
+      if (a.slave != b.slave) return a.slave < b.slave;
+      if (a.functionCode != b.functionCode) return a.functionCode < b.functionCode;
+      return a.address < b.address;
+    }
+
+    /*
+    Stable insertion sort of the write order by slave, function code and address.
+    Writes to the same address keep the order they were staged in.
+    */
+    void _sort(){
+      for (uint8_t pos = 0; pos < _writeCount; pos++){
+        uint8_t id = pos;
+        uint8_t idx = pos;
+        while (idx > 0 && _less(_writes[id], _writes[_order[idx - 1]])){
+          _order[idx] = _order[idx - 1];
+          idx--;
+        }
+        _order[idx] = id;
+      }
+    }
+
+    void _finish(uint8_t idx, ErrorCode code){
+      WriteRequest &request = _requests[idx];
+      if (request.done){
+        return;
+      }
+      request.done = true;
+      for (uint8_t pos = request.first; pos <= request.last; pos++){
+        const Write &write = _writes[_order[pos]];
+        if (write.onComplete){
+          write.onComplete(this, _order[pos], code);
+        }
+      }
+    }
+
+    bool _emit(uint8_t first, uint8_t last, uint32_t start, uint32_t end){
+      if (_requestCount >= MBWRITE_MAX_REQUESTS){
+        _requestCount = 0;
+        return false;
+      }
+      const Write &write = _writes[_order[first]];
+      WriteRequest &request = _requests[_requestCount++];
+      request.slave = write.slave;
+      request.functionCode = write.functionCode;
+      if (end > start){
+        request.functionCode = write.functionCode == 0x05 ? 0x0F : 0x10;
+      }
+      request.address = start;
+      request.quantity = end - start + 1;
+      request.first = first;
+      request.last = last;
+      request.done = false;
+      return true;
+    }
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include "Arduino.h"
+#include "mbbits.h"
+
+// 10 coils 0xCD 0x01 at address 0x13, see WriteRequest15
+uint8_t BitsRequest15[] {0x01, 0x0F, 0x00, 0x13, 0x00, 0x0A, 0x02, 0xCD, 0x01, 0x72, 0xCB};
+uint8_t BitsResponse02[] {0x08, 0x02, 0x01, 0x33, 0xE2, 0x01};
+
+uint32_t bitsSeed{7};
+
+uint8_t bitsRandom(){
+    bitsSeed ^= bitsSeed << 13;
+    bitsSeed ^= bitsSeed >> 17;
+    bitsSeed ^= bitsSeed << 5;
+    return bitsSeed;
+}
+
+void GivenRequest15_WhenUnpacked_ReturnCoils(){
+    RequestParser parser{};
+    parser.parse(BitsRequest15, 11);
+    uint8_t coils[16];
+    uint8_t expected[10] {1, 0, 1, 1, 0, 0, 1, 1, 1, 0};
+
+    assert(ModbusBits::unpack(parser, coils));
+    assert(memcmp(coils, expected, 10) == 0);
+}
+
+void GivenResponse02_WhenUnpacked_ValidateQuantity(){
+    ResponseParser parser{};
+    parser.parse(BitsResponse02, 6);
+    uint8_t coils[16];
+
+    assert(ModbusBits::unpack(parser, 6, coils));
+    assert(coils[0] == 1 && coils[1] == 1 && coils[2] == 0 && coils[4] == 1 && coils[5] == 1);
+    assert(!ModbusBits::unpack(parser, 9, coils));
+    assert(!ModbusBits::unpack(parser, 0, coils));
+}
+
+void GivenCoils_WhenPacked_ClearUnusedBits(){
+    bool coils[10] {true, false, true, true, false, false, true, true, true, false};
+    uint8_t data[2] {0xFF, 0xFF};
+
+    assert(ModbusBits::pack(coils, 10, data) == 2);
+    assert(data[0] == 0xCD && data[1] == 0x01);
+}
+
+void GivenRandomCoils_WhenPackedAndUnpacked_MatchReference(){
+    uint8_t coils[MB_MAX_READ_BITS];
+    uint8_t unpacked[MB_MAX_READ_BITS];
+    uint8_t data[MB_MAX_READ_BITS / 8];
+    for (uint16_t run = 0; run < 200; run++){
+        uint16_t quantity = run < 40 ? run + 1 : 1 + (uint16_t(bitsRandom()) << 8 | bitsRandom()) % MB_MAX_READ_BITS;
+        for (uint16_t idx = 0; idx < quantity; idx++){
+            coils[idx] = bitsRandom() % 3; // 0, 1 or 2 (non zero is on)
+        }
+        uint8_t byteCount = ModbusBits::pack(coils, quantity, data);
+        assert(ModbusBits::isValid(quantity, byteCount));
+        for (uint16_t idx = 0; idx < quantity; idx++){
+            assert(ModbusBits::getBit(data, idx) == (coils[idx] != 0));
+        }
+        if (quantity % 8){
+            assert((data[byteCount - 1] >> (quantity % 8)) == 0);
+        }
+
+        ModbusBits::unpack(data, quantity, unpacked);
+        for (uint16_t idx = 0; idx < quantity; idx++){
+            assert(unpacked[idx] == (coils[idx] != 0));
+        }
+    }
+}
+
+void GivenBit_WhenSet_ChangeOnlyBit(){
+    uint8_t data[2] {0x00, 0xFF};
+    ModbusBits::setBit(data, 3, true);
+    ModbusBits::setBit(data, 9, false);
+    assert(data[0] == 0x08 && data[1] == 0xFD);
+}
+
+void profile_unpack(){
+    uint8_t data[MB_MAX_READ_BITS / 8];
+    uint8_t coils[MB_MAX_READ_BITS];
+    for (uint16_t idx = 0; idx < sizeof(data); idx++){
+        data[idx] = bitsRandom();
+    }
+    uint32_t checksum = 0;
+    unsigned long start = micros();
+    for (uint16_t run = 0; run < 10000; run++){
+        ModbusBits::unpack(data, MB_MAX_READ_BITS, coils);
+        checksum += coils[run % MB_MAX_READ_BITS];
+        ModbusBits::pack(coils, MB_MAX_READ_BITS, data);
+    }
+    unsigned long took = micros() - start;
+    printf("\nCoils: %lu us for 10000 x 2000 coils unpacked and packed (%u)\n", took, unsigned(checksum));
+}
+
+void test_mbbits(){
+    printf("\n\n -- TEST BITS STARTING -- \n\n");
+    GivenRequest15_WhenUnpacked_ReturnCoils();
+    printf(".");
+    GivenResponse02_WhenUnpacked_ValidateQuantity();
+    printf(".");
+    GivenCoils_WhenPacked_ClearUnusedBits();
+    printf(".");
+    GivenRandomCoils_WhenPackedAndUnpacked_MatchReference();
+    printf(".");
+    GivenBit_WhenSet_ChangeOnlyBit();
+    printf(".");
+    profile_unpack();
+    printf("\nTEST DONE.");
+}
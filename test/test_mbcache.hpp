@@ -0,0 +1,91 @@
+#include "Arduino.h"
+#include "mbcache.h"
+
+uint8_t CacheResponse03[] {0x01, 0x03, 0x04, 0x0, 0x6, 0x0, 0x05, 0xDA, 0x31};
+
+uint8_t cachePDU[MB_MAX_PDU];
+
+void GivenTTLRanges_WhenLookedUp_ReturnFirstMatch(){
+    ReadCache cache{};
+    cache.setTTL(1, 0x03, 0, 100, 500);
+    cache.setTTL(1, 0x03, 0, 1000, 50);
+    cache.setDefaultTTL(10);
+
+    assert(cache.ttl(1, 0x03, 10, 20) == 500);
+    assert(cache.ttl(1, 0x03, 90, 20) == 50);
+    assert(cache.ttl(1, 0x04, 10, 20) == 10);
+    assert(cache.ttl(2, 0x03, 10, 20) == 10);
+}
+
+void GivenStoredResponse_WhenFresh_BuildPDU(){
+    ReadCache cache{};
+    cache.setTTL(1, 0x03, 0, 10, 100);
+    ResponseParser parser{};
+    parser.parse(CacheResponse03, 9);
+
+    assert(cache.store(1, 0x03, 0, 2, parser, 1000));
+    assert(cache.responsePDU(cachePDU, 1, 0x03, 0, 2, 1099) == 6);
+    assert(cachePDU[0] == 0x03 && cachePDU[1] == 4 && cachePDU[3] == 0x06 && cachePDU[5] == 0x05);
+    assert(cache.responsePDU(cachePDU, 1, 0x03, 0, 2, 1100) == 0);
+    assert(cache.responsePDU(cachePDU, 1, 0x03, 1, 2, 1000) == 0);
+    assert(cache.hits() == 1 && cache.misses() == 2);
+}
+
+void GivenUncachedRange_WhenStored_Ignore(){
+    ReadCache cache{};
+    ResponseParser parser{};
+    parser.parse(CacheResponse03, 9);
+
+    assert(!cache.store(1, 0x03, 0, 2, parser, 0));
+    assert(!cache.store(1, 0x04, 0, 2, parser, 0));
+    assert(cache.entries() == 0);
+}
+
+void GivenOverlappingWrite_WhenInvalidated_DropRead(){
+    ReadCache cache{};
+    cache.setDefaultTTL(100);
+    ResponseParser parser{};
+    parser.parse(CacheResponse03, 9);
+    cache.store(1, 0x03, 10, 2, parser, 0);
+    cache.store(1, 0x03, 20, 2, parser, 0);
+
+    cache.invalidate(1, 0x05, 10, 1); // coils, other table
+    cache.invalidate(2, 0x06, 10, 1); // other slave
+    cache.invalidate(1, 0x10, 12, 8); // between both reads
+    assert(cache.entries() == 2);
+    cache.invalidate(1, 0x06, 11, 1);
+    assert(cache.entries() == 1);
+    assert(cache.responsePDU(cachePDU, 1, 0x03, 20, 2, 1) > 0);
+}
+
+void GivenFullCache_WhenStored_EvictOldest(){
+    ReadCache cache{};
+    cache.setDefaultTTL(1000);
+    ResponseParser parser{};
+    parser.parse(CacheResponse03, 9);
+    for (uint16_t idx = 0; idx < MBCACHE_ENTRIES; idx++){
+        cache.store(1, 0x03, idx * 2, 2, parser, idx);
+    }
+    assert(cache.entries() == MBCACHE_ENTRIES);
+
+    cache.store(1, 0x03, 1000, 2, parser, 100);
+    assert(cache.entries() == MBCACHE_ENTRIES);
+    assert(cache.responsePDU(cachePDU, 1, 0x03, 0, 2, 100) == 0);
+    assert(cache.responsePDU(cachePDU, 1, 0x03, 2, 2, 100) > 0);
+    assert(cache.responsePDU(cachePDU, 1, 0x03, 1000, 2, 100) > 0);
+}
+
+void test_mbcache(){
+    printf("\n\n -- TEST CACHE STARTING -- \n\n");
+    GivenTTLRanges_WhenLookedUp_ReturnFirstMatch();
+    printf(".");
+    GivenStoredResponse_WhenFresh_BuildPDU();
+    printf(".");
+    GivenUncachedRange_WhenStored_Ignore();
+    printf(".");
+    GivenOverlappingWrite_WhenInvalidated_DropRead();
+    printf(".");
+    GivenFullCache_WhenStored_EvictOldest();
+    printf(".");
+    printf("\nTEST DONE.");
+}
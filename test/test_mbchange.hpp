@@ -0,0 +1,160 @@
+#include "Arduino.h"
+#include "mbchange.h"
+
+uint8_t ChangeResponse03[] {0x01, 0x03, 0x04, 0x0, 0x6, 0x0, 0x05, 0xDA, 0x31};
+
+uint8_t changeCalls{0};
+uint16_t changeAddress[4];
+uint16_t changeQuantity[4];
+
+void changeCollect(ChangeDetector *detector, uint8_t slave, uint8_t fc, uint16_t address, uint16_t quantity, const uint8_t *data){
+    if (changeCalls < 4){
+        changeAddress[changeCalls] = address;
+        changeQuantity[changeCalls] = quantity;
+    }
+    changeCalls++;
+}
+
+void GivenFirstPayload_WhenChecked_PassWholeRange(){
+    ChangeDetector detector{};
+    ResponseParser parser{};
+    changeCalls = 0;
+    detector.setOnChangeCB(changeCollect);
+    parser.parse(ChangeResponse03, 9);
+
+    assert(detector.check(parser, 100, 2) == ChangeStatus::first);
+    assert(changeCalls == 1);
+    assert(changeAddress[0] == 100 && changeQuantity[0] == 2);
+    assert(detector.check(parser, 100, 2) == ChangeStatus::unchanged);
+    assert(changeCalls == 1);
+    assert(detector.suppressed() == 1);
+    assert(detector.passed() == 1);
+}
+
+void GivenChangedRegisters_WhenChecked_ReportRanges(){
+    ChangeDetector detector{};
+    changeCalls = 0;
+    detector.setOnChangeCB(changeCollect);
+    uint8_t data[40]{};
+    detector.check(1, 0x04, 0, 20, data, 40);
+    changeCalls = 0;
+
+    data[3] = 1;   // register 1
+    data[5] = 1;   // register 2
+    data[30] = 1;  // register 15
+    assert(detector.check(1, 0x04, 0, 20, data, 40) == ChangeStatus::changed);
+    assert(changeCalls == 2);
+    assert(changeAddress[0] == 1 && changeQuantity[0] == 2);
+    assert(changeAddress[1] == 15 && changeQuantity[1] == 1);
+
+    // image learned the change
+    changeCalls = 0;
+    assert(detector.check(1, 0x04, 0, 20, data, 40) == ChangeStatus::unchanged);
+    assert(changeCalls == 0);
+}
+
+void GivenMergeGap_WhenChecked_MergeRanges(){
+    ChangeDetector detector{};
+    detector.setOnChangeCB(changeCollect);
+    detector.setMergeGap(2);
+    uint8_t data[20]{};
+    detector.check(1, 0x03, 10, 10, data, 20);
+    changeCalls = 0;
+
+    data[0] = 1;   // register 10
+    data[7] = 1;   // register 13
+    data[19] = 1;  // register 19
+    detector.check(1, 0x03, 10, 10, data, 20);
+    assert(changeCalls == 2);
+    assert(changeAddress[0] == 10 && changeQuantity[0] == 4);
+    assert(changeAddress[1] == 19 && changeQuantity[1] == 1);
+}
+
+void GivenChangedCoils_WhenChecked_ReportCoilRange(){
+    ChangeDetector detector{};
+    detector.setOnChangeCB(changeCollect);
+    uint8_t data[3]{};
+    detector.check(1, 0x01, 0, 20, data, 3);
+    changeCalls = 0;
+
+    data[2] = 0x08;  // coil 19
+    detector.check(1, 0x01, 0, 20, data, 3);
+    assert(changeCalls == 1);
+    assert(changeAddress[0] == 16 && changeQuantity[0] == 4);
+}
+
+void GivenFullImage_WhenChecked_UseFingerprint(){
+    ChangeDetector detector{};
+    detector.setOnChangeCB(changeCollect);
+    uint8_t data[250]{};
+    uint16_t keys = MBCHANGE_IMAGE_SIZE / 250 + 1;
+    for (uint16_t key = 0; key < keys; key++){
+        detector.check(1, 0x03, key * 125, 125, data, 250);
+    }
+    assert(detector.imageUsed() == (keys - 1) * 250);
+    changeCalls = 0;
+    uint16_t address = (keys - 1) * 125;
+
+    assert(detector.check(1, 0x03, address, 125, data, 250) == ChangeStatus::unchanged);
+    data[100] = 1;
+    assert(detector.check(1, 0x03, address, 125, data, 250) == ChangeStatus::changed);
+    assert(changeCalls == 1);
+    assert(changeAddress[0] == address && changeQuantity[0] == 125);
+}
+
+void GivenInvalidatedSlave_WhenChecked_ReturnFirst(){
+    ChangeDetector detector{};
+    uint8_t data[4]{};
+    detector.check(1, 0x03, 0, 2, data, 4);
+    detector.check(2, 0x03, 0, 2, data, 4);
+    detector.invalidate(1);
+
+    assert(detector.check(1, 0x03, 0, 2, data, 4) == ChangeStatus::first);
+    assert(detector.check(2, 0x03, 0, 2, data, 4) == ChangeStatus::unchanged);
+    assert(detector.entries() == 2);
+}
+
+void GivenFullTable_WhenChecked_ReturnUntracked(){
+    ChangeDetector detector{};
+    uint8_t data[2]{};
+    for (uint8_t key = 0; key < MBCHANGE_MAX_ENTRIES; key++){
+        assert(detector.check(1, 0x03, key, 1, data, 2) == ChangeStatus::first);
+    }
+    assert(detector.check(1, 0x03, 1000, 1, data, 2) == ChangeStatus::untracked);
+    assert(detector.check(1, 0x03, 1000, 1, data, 2) == ChangeStatus::untracked);
+}
+
+void GivenMismatchedByteCount_WhenChecked_ReturnUntracked(){
+    ChangeDetector detector{};
+    uint8_t data[4]{};
+    changeCalls = 0;
+    detector.setOnChangeCB(changeCollect);
+
+    assert(detector.check(1, 0x03, 0, 2, data, 3) == ChangeStatus::untracked);
+    assert(detector.check(1, 0x01, 0, 9, data, 1) == ChangeStatus::untracked);
+    assert(detector.check(1, 0x03, 0, 2, nullptr, 4) == ChangeStatus::untracked);
+    assert(detector.entries() == 0);
+    assert(changeCalls == 0);
+    assert(detector.check(1, 0x01, 0, 9, data, 2) == ChangeStatus::first);
+}
+
+void test_mbchange(){
+    printf("\n\n -- TEST CHANGE DETECTOR STARTING -- \n\n");
+    GivenFirstPayload_WhenChecked_PassWholeRange();
+    printf(".");
+    GivenChangedRegisters_WhenChecked_ReportRanges();
+    printf(".");
+    GivenMergeGap_WhenChecked_MergeRanges();
+    printf(".");
+    GivenChangedCoils_WhenChecked_ReportCoilRange();
+    printf(".");
+    GivenFullImage_WhenChecked_UseFingerprint();
+    printf(".");
+    GivenInvalidatedSlave_WhenChecked_ReturnFirst();
+    printf(".");
+    GivenFullTable_WhenChecked_ReturnUntracked();
+    printf(".");
+    GivenMismatchedByteCount_WhenChecked_ReturnUntracked();
+    printf(".");
+    printf("\nTEST DONE.");
+}
@@ -0,0 +1,163 @@
+#include "Arduino.h"
+#include "mbdeadline.h"
+
+uint8_t DeadlinePartialResponse03[] {0x01, 0x03, 0x04, 0x0};
+
+uint8_t deadlineTimeouts{0};
+
+void deadlineOnTimeout(DeadlineManager<ResponseParser> *manager, uint8_t slave, ResponseParser *parser){
+    assert(slave == 1);
+    assert(parser->state() == ParserState::slaveAddress);
+    deadlineTimeouts++;
+}
+
+unsigned long deadlineNow{0};
+
+void deadlineRestart(DeadlineManager<ResponseParser> *manager, uint8_t slave, ResponseParser *parser){
+    deadlineTimeouts++;
+    if (deadlineTimeouts < 3){
+        assert(manager->start(parser, slave, deadlineNow) != MBDEADLINE_INVALID);
+    }
+}
+
+void GivenPartialResponse_WhenExpired_ResetParser(){
+    DeadlineManager<ResponseParser> manager{};
+    ResponseParser parser{};
+    deadlineTimeouts = 0;
+    manager.setOnTimeoutCB(deadlineOnTimeout);
+    manager.setInitialTimeout(50);
+
+    manager.start(&parser, 1, 1000);
+    parser.parse(DeadlinePartialResponse03, 4);
+    assert(parser.state() == ParserState::data);
+    manager.advance(1049);
+    assert(deadlineTimeouts == 0);
+    manager.advance(1050);
+    assert(deadlineTimeouts == 1);
+    assert(parser.state() == ParserState::slaveAddress);
+    assert(manager.outstanding() == 0);
+}
+
+void GivenLongTimeout_WhenAdvanced_ExpireOnTime(){
+    DeadlineManager<ResponseParser> manager{};
+    ResponseParser parser{};
+    deadlineTimeouts = 0;
+    manager.setOnTimeoutCB(deadlineOnTimeout);
+    manager.setInitialTimeout(300);
+
+    manager.start(&parser, 1, 10);
+    manager.advance(200);
+    manager.advance(309);
+    assert(deadlineTimeouts == 0);
+    manager.advance(310);
+    assert(deadlineTimeouts == 1);
+}
+
+void GivenCompletedTransaction_WhenAdvanced_DoNotExpire(){
+    DeadlineManager<ResponseParser> manager{};
+    ResponseParser parser{};
+    deadlineTimeouts = 0;
+    manager.setOnTimeoutCB(deadlineOnTimeout);
+
+    uint16_t handle = manager.start(&parser, 1, 0);
+    assert(manager.complete(handle, 20));
+    manager.advance(5000);
+    assert(deadlineTimeouts == 0);
+    assert(!manager.complete(handle, 5000));
+}
+
+void GivenFastSlave_WhenCompleted_LearnShortTimeout(){
+    DeadlineManager<ResponseParser> manager{};
+    ResponseParser parser{};
+    manager.setLimits(5, 1000);
+
+    unsigned long now = 0;
+    for (uint8_t i = 0; i < 20; i++){
+        uint16_t handle = manager.start(&parser, 7, now);
+        now += 20;
+        manager.complete(handle, now);
+    }
+    assert(manager.latency(7) == 20);
+    assert(manager.timeout(7) >= 20 && manager.timeout(7) < 30);
+    assert(manager.timeout(8) == 100);
+}
+
+void GivenLearnedTimeout_WhenLimitsChanged_ClampTimeout(){
+    DeadlineManager<ResponseParser> manager{};
+    ResponseParser parser{};
+    manager.setLimits(5, 1000);
+
+    unsigned long now = 0;
+    for (uint8_t i = 0; i < 20; i++){
+        uint16_t handle = manager.start(&parser, 7, now);
+        now += 20;
+        manager.complete(handle, now);
+    }
+    manager.setLimits(50, 1000);
+    assert(manager.timeout(7) == 50);
+    manager.setLimits(5, 10);
+    assert(manager.timeout(7) == 10);
+    assert(manager.timeout(8) == 100);
+}
+
+void GivenExpiredTransaction_WhenExpired_BackoffTimeout(){
+    DeadlineManager<ResponseParser> manager{};
+    ResponseParser parser{};
+    manager.setInitialTimeout(40);
+
+    manager.start(&parser, 1, 0);
+    manager.advance(100);
+    assert(manager.timeout(1) == 80);
+}
+
+void GivenTimeoutCallback_WhenRestarted_ExpireOnNewDeadline(){
+    DeadlineManager<ResponseParser> manager{};
+    ResponseParser parser{};
+    deadlineTimeouts = 0;
+    manager.setOnTimeoutCB(deadlineRestart);
+    manager.setInitialTimeout(12);
+
+    manager.start(&parser, 1, 48);
+    // expires at 60, the restart at 100 times out after 24 ticks at 124, in the slot of 60
+    deadlineNow = 100;
+    manager.advance(deadlineNow);
+    assert(deadlineTimeouts == 1);
+    assert(manager.outstanding() == 1);
+    manager.advance(123);
+    assert(deadlineTimeouts == 1);
+    deadlineNow = 124;
+    manager.advance(deadlineNow);
+    assert(deadlineTimeouts == 2);
+    assert(manager.outstanding() == 1);
+}
+
+void GivenAllTimersInUse_WhenStarted_ReturnInvalid(){
+    DeadlineManager<ResponseParser> manager{};
+    ResponseParser parser{};
+
+    for (uint8_t i = 0; i < MBDEADLINE_MAX_TIMERS; i++){
+        assert(manager.start(&parser, i, 0) != MBDEADLINE_INVALID);
+    }
+    assert(manager.start(&parser, 1, 0) == MBDEADLINE_INVALID);
+}
+
+void test_mbdeadline(){
+    printf("\n\n -- TEST DEADLINE STARTING -- \n\n");
+    GivenPartialResponse_WhenExpired_ResetParser();
+    printf(".");
+    GivenLongTimeout_WhenAdvanced_ExpireOnTime();
+    printf(".");
+    GivenCompletedTransaction_WhenAdvanced_DoNotExpire();
+    printf(".");
+    GivenFastSlave_WhenCompleted_LearnShortTimeout();
+    printf(".");
+    GivenLearnedTimeout_WhenLimitsChanged_ClampTimeout();
+    printf(".");
+    GivenExpiredTransaction_WhenExpired_BackoffTimeout();
+    printf(".");
+    GivenTimeoutCallback_WhenRestarted_ExpireOnNewDeadline();
+    printf(".");
+    GivenAllTimersInUse_WhenStarted_ReturnInvalid();
+    printf(".");
+    printf("\nTEST DONE.");
+}
@@ -0,0 +1,269 @@
+#include "Arduino.h"
+#include "mbframebus.h"
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+uint8_t BusResponse03[] {0x01, 0x03, 0x04, 0x0, 0x6, 0x0, 0x05, 0xDA, 0x31};
+uint8_t BusRequest06[] {0x11, 0x06, 0x00, 0x01, 0x00, 0x03, 0x9A, 0x9B};
+
+uint32_t busMemory[2048];
+
+void GivenCompletedFrames_WhenPublished_ReadByAllSubscribers(){
+    FrameBusPublisher publisher{};
+    FrameBusSubscriber historian{};
+    FrameBusSubscriber alarms{};
+    uint8_t *memory = reinterpret_cast<uint8_t*>(busMemory);
+    assert(publisher.begin(memory, FrameBus::memorySize(8)));
+    assert(publisher.slots() == 8);
+    assert(historian.attach(memory, sizeof(busMemory)));
+    assert(alarms.attach(memory, sizeof(busMemory)));
+
+    ResponseParser response{};
+    response.parse(BusResponse03, 9);
+    publisher.publish(response, 1000);
+    RequestParser request{};
+    request.parse(BusRequest06, 8);
+    publisher.publish(request, 1001);
+
+    BusFrame frame;
+    assert(historian.read(frame) == BusReadStatus::frame);
+    assert(frame.timestamp == 1000 && frame.slave == 1 && frame.functionCode == 0x03 && !frame.isRequest);
+    assert(frame.byteCount == 4 && frame.data[1] == 0x06);
+    assert(historian.read(frame) == BusReadStatus::frame);
+    assert(frame.isRequest && frame.slave == 0x11 && frame.address == 1);
+    assert(frame.byteCount == 2 && frame.data[1] == 0x03);
+    assert(historian.read(frame) == BusReadStatus::empty);
+
+    assert(alarms.available() == 2);
+    assert(alarms.read(frame) == BusReadStatus::frame);
+    assert(frame.timestamp == 1000);
+}
+
+void GivenStreamingParser_WhenPublished_PublishWithoutPayload(){
+    FrameBusPublisher publisher{};
+    FrameBusSubscriber subscriber{};
+    uint8_t *memory = reinterpret_cast<uint8_t*>(busMemory);
+    publisher.begin(memory, FrameBus::memorySize(4));
+    subscriber.attach(memory, sizeof(busMemory));
+
+    ResponseParser response{};
+    response.setOnDataCB([](ResponseParser *parser, const uint8_t *data, uint16_t len, uint16_t offset){});
+    response.parse(BusResponse03, 9);
+    publisher.publish(response, 1000);
+
+    BusFrame frame;
+    assert(subscriber.read(frame) == BusReadStatus::frame);
+    assert(frame.slave == 1 && frame.functionCode == 0x03);
+    assert(frame.byteCount == 0);
+}
+
+void GivenSlowSubscriber_WhenOverrun_SkipToOldestFrame(){
+    FrameBusPublisher publisher{};
+    FrameBusSubscriber subscriber{};
+    uint8_t *memory = reinterpret_cast<uint8_t*>(busMemory);
+    publisher.begin(memory, FrameBus::memorySize(4));
+    subscriber.attach(memory, sizeof(busMemory));
+
+    BusFrame frame{};
+    for (uint32_t idx = 0; idx < 10; idx++){
+        frame.timestamp = idx;
+        publisher.publish(frame);
+    }
+
+    assert(subscriber.read(frame) == BusReadStatus::overrun);
+    assert(subscriber.lost() == 7);
+    assert(subscriber.read(frame) == BusReadStatus::frame);
+    assert(frame.timestamp == 7);
+    assert(subscriber.read(frame) == BusReadStatus::frame);
+    assert(subscriber.read(frame) == BusReadStatus::frame);
+    assert(frame.timestamp == 9);
+    assert(subscriber.read(frame) == BusReadStatus::empty);
+    assert(subscriber.received() == 3);
+}
+
+void GivenPeekedFrame_WhenOverwritten_FailRelease(){
+    FrameBusPublisher publisher{};
+    FrameBusSubscriber subscriber{};
+    uint8_t *memory = reinterpret_cast<uint8_t*>(busMemory);
+    publisher.begin(memory, FrameBus::memorySize(2));
+    subscriber.attach(memory, sizeof(busMemory));
+
+    BusFrame frame{};
+    frame.timestamp = 1;
+    publisher.publish(frame);
+    const BusFrame *slot = nullptr;
+    assert(subscriber.peek(slot) == BusReadStatus::frame);
+    assert(slot->timestamp == 1);
+    assert(subscriber.release());
+
+    frame.timestamp = 2;
+    publisher.publish(frame);
+    assert(subscriber.peek(slot) == BusReadStatus::frame);
+    // the publisher laps the subscriber while it reads
+    publisher.publish(frame);
+    publisher.publish(frame);
+    assert(!subscriber.release());
+    assert(subscriber.lost() > 0);
+}
+
+void GivenForeignMemory_WhenAttached_Reject(){
+    FrameBusSubscriber subscriber{};
+    uint32_t memory[64]{};
+    assert(!subscriber.attach(reinterpret_cast<uint8_t*>(memory), sizeof(memory)));
+    FrameBusPublisher publisher{};
+    assert(!publisher.begin(reinterpret_cast<uint8_t*>(memory), sizeof(memory)));
+
+    // a ring header without slots
+    memory[0] = MBFRAMEBUS_MAGIC;
+    memory[2] = sizeof(BusFrame) + 4;
+    assert(!subscriber.attach(reinterpret_cast<uint8_t*>(memory), sizeof(memory)));
+}
+
+void GivenRestartedPublisher_WhenRead_ResyncToNewFrames(){
+    FrameBusPublisher publisher{};
+    FrameBusSubscriber subscriber{};
+    uint8_t *memory = reinterpret_cast<uint8_t*>(busMemory);
+    memset(busMemory, 0, sizeof(busMemory));
+    publisher.begin(memory, FrameBus::memorySize(8));
+    assert(publisher.generation() == 1);
+    subscriber.attach(memory, sizeof(busMemory));
+
+    BusFrame frame{};
+    for (uint32_t idx = 0; idx < 5; idx++){
+        frame.timestamp = idx;
+        publisher.publish(frame);
+    }
+    assert(subscriber.read(frame) == BusReadStatus::frame);
+
+    FrameBusPublisher restarted{};
+    restarted.begin(memory, FrameBus::memorySize(8));
+    assert(restarted.generation() == 2);
+    frame.timestamp = 100;
+    restarted.publish(frame);
+    assert(subscriber.read(frame) == BusReadStatus::restarted);
+    assert(subscriber.restarts() == 1);
+    assert(subscriber.read(frame) == BusReadStatus::frame);
+    assert(frame.timestamp == 100);
+    assert(subscriber.read(frame) == BusReadStatus::empty);
+    frame.timestamp = 101;
+    restarted.publish(frame);
+    assert(subscriber.read(frame) == BusReadStatus::frame);
+    assert(frame.timestamp == 101);
+    assert(subscriber.lost() == 0);
+}
+
+/*
+Runs a publisher in a child process on shared memory, which publishes count frames from
+timestamp first. subscriber, if given, is attached after the publisher formatted the ring.
+*/
+void busPublisherProcess(uint8_t *memory, size_t size, uint32_t *control, FrameBusSubscriber *subscriber,
+        uint32_t first, uint32_t count){
+    __atomic_store_n(control, 0, __ATOMIC_RELEASE);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0){
+        FrameBusPublisher publisher{};
+        if (!publisher.begin(memory, size)){
+            _exit(1);
+        }
+        __atomic_store_n(control, 1, __ATOMIC_RELEASE);
+        while (__atomic_load_n(control, __ATOMIC_ACQUIRE) != 2){
+        }
+        BusFrame frame{};
+        for (uint32_t idx = 0; idx < count; idx++){
+            frame.timestamp = first + idx;
+            publisher.publish(frame);
+        }
+        _exit(0);
+    }
+    while (__atomic_load_n(control, __ATOMIC_ACQUIRE) != 1){
+    }
+    if (subscriber){
+        assert(subscriber->attach(memory, size));
+    }
+    __atomic_store_n(control, 2, __ATOMIC_RELEASE);
+    int status = 0;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void GivenPublisherProcess_WhenRestarted_SubscriberResyncs(){
+    size_t size = FrameBus::memorySize(4);
+    uint8_t *shared = static_cast<uint8_t*>(mmap(nullptr, size + 4, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    assert(shared != MAP_FAILED);
+    uint32_t *control = reinterpret_cast<uint32_t*>(shared);
+    uint8_t *memory = shared + 4;
+    FrameBusSubscriber subscriber{};
+    busPublisherProcess(memory, size, control, &subscriber, 100, 3);
+
+    BusFrame frame;
+    assert(subscriber.read(frame) == BusReadStatus::frame);
+    assert(frame.timestamp == 100);
+    assert(subscriber.read(frame) == BusReadStatus::frame);
+    assert(frame.timestamp == 101);
+
+    // the restarted publisher has a head behind the subscriber
+    busPublisherProcess(memory, size, control, nullptr, 200, 1);
+    assert(subscriber.read(frame) == BusReadStatus::restarted);
+    assert(subscriber.read(frame) == BusReadStatus::frame);
+    assert(frame.timestamp == 200);
+    assert(subscriber.read(frame) == BusReadStatus::empty);
+
+    // the restarted publisher laps the subscriber
+    busPublisherProcess(memory, size, control, nullptr, 300, 6);
+    assert(subscriber.read(frame) == BusReadStatus::restarted);
+    assert(subscriber.read(frame) == BusReadStatus::overrun);
+    for (uint32_t timestamp = 303; timestamp < 306; timestamp++){
+        assert(subscriber.read(frame) == BusReadStatus::frame);
+        assert(frame.timestamp == timestamp);
+    }
+    assert(subscriber.read(frame) == BusReadStatus::empty);
+    assert(subscriber.restarts() == 2);
+    assert(subscriber.lost() == 3);
+    munmap(shared, size + 4);
+}
+
+void profile_framebus(){
+    FrameBusPublisher publisher{};
+    FrameBusSubscriber subscriber{};
+    uint8_t *memory = reinterpret_cast<uint8_t*>(busMemory);
+    publisher.begin(memory, sizeof(busMemory));
+    subscriber.attach(memory, sizeof(busMemory));
+    ResponseParser parser{};
+    parser.parse(BusResponse03, 9);
+    BusFrame frame;
+    uint32_t received = 0;
+    unsigned long start = micros();
+    for (uint32_t idx = 0; idx < 1000000; idx++){
+        publisher.publish(parser, idx);
+        if ((idx & 0x0F) == 0x0F){
+            while (subscriber.read(frame) != BusReadStatus::empty){
+                received++;
+            }
+        }
+    }
+    unsigned long took = micros() - start;
+    printf("\nFrame bus: 1000000 frames published, %u received in %lu us\n", unsigned(received), took);
+}
+
+void test_mbframebus(){
+    printf("\n\n -- TEST FRAME BUS STARTING -- \n\n");
+    GivenCompletedFrames_WhenPublished_ReadByAllSubscribers();
+    printf(".");
+    GivenStreamingParser_WhenPublished_PublishWithoutPayload();
+    printf(".");
+    GivenSlowSubscriber_WhenOverrun_SkipToOldestFrame();
+    printf(".");
+    GivenPeekedFrame_WhenOverwritten_FailRelease();
+    printf(".");
+    GivenForeignMemory_WhenAttached_Reject();
+    printf(".");
+    GivenRestartedPublisher_WhenRead_ResyncToNewFrames();
+    printf(".");
+    GivenPublisherProcess_WhenRestarted_SubscriberResyncs();
+    printf(".");
+    profile_framebus();
+    printf("\nTEST DONE.");
+}
@@ -0,0 +1,338 @@
+#include "Arduino.h"
+#include "mbgateway.h"
+
+// TCP ADU: tid 1, unit 1, FC03 address 0 quantity 2
+uint8_t TCPRequest03[] {0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, 0x00, 0x00, 0x02};
+uint8_t RTURequest03[] {0x01, 0x03, 0x00, 0x00, 0x00, 0x02, 0xC4, 0x0B};
+uint8_t RTUResponse03[] {0x01, 0x03, 0x04, 0x0, 0x6, 0x0, 0x05, 0xDA, 0x31};
+uint8_t TCPResponse03[] {0x00, 0x01, 0x00, 0x00, 0x00, 0x07, 0x01, 0x03, 0x04, 0x00, 0x06, 0x00, 0x05};
+uint8_t TCPRequest07[] {0x00, 0x02, 0x00, 0x00, 0x00, 0x02, 0x01, 0x07};
+// TCP ADU: tid 3, unit 1, FC06 address 1 value 3
+uint8_t TCPRequest06[] {0x00, 0x03, 0x00, 0x00, 0x00, 0x06, 0x01, 0x06, 0x00, 0x01, 0x00, 0x03};
+uint8_t RTUResponse06[] {0x01, 0x06, 0x00, 0x01, 0x00, 0x03, 0x98, 0x0B};
+// TCP ADU: tid 4, unit 0 (broadcast), FC06 address 1 value 3
+uint8_t TCPBroadcast06[] {0x00, 0x04, 0x00, 0x00, 0x00, 0x06, 0x00, 0x06, 0x00, 0x01, 0x00, 0x03};
+// frame of slave 2, its payload looks like the start of a frame of slave 1
+uint8_t RTUForeignNoise[] {0x02, 0x06, 0x01, 0x07, 0x00, 0x00};
+
+uint8_t gwBusFrame[MB_RTU_MAX_ADU];
+uint16_t gwBusLen{0};
+uint8_t gwBusWrites{0};
+uint8_t gwClientAdu[MB_TCP_MAX_ADU];
+uint16_t gwClientLen{0};
+uint8_t gwClient{0};
+uint8_t gwClientWrites{0};
+uint8_t gwClientMask{0};
+
+void gwBusWriter(ModbusGateway *gateway, uint8_t bus, const uint8_t *frame, uint16_t len){
+    memcpy(gwBusFrame, frame, len);
+    gwBusLen = len;
+    gwBusWrites++;
+}
+
+void gwClientWriter(ModbusGateway *gateway, uint8_t client, const uint8_t *adu, uint16_t len){
+    memcpy(gwClientAdu, adu, len);
+    gwClientLen = len;
+    gwClient = client;
+    gwClientWrites++;
+    gwClientMask |= 1 << client;
+}
+
+void gwSetup(ModbusGateway &gateway){
+    gwBusLen = 0;
+    gwBusWrites = 0;
+    gwClientLen = 0;
+    gwClientWrites = 0;
+    gwClientMask = 0;
+    gateway.setBusWriter(gwBusWriter);
+    gateway.setClientWriter(gwClientWriter);
+}
+
+void GivenTCPRequest_WhenSubmitted_WriteRTUFrame(){
+    ModbusGateway gateway{};
+    gwSetup(gateway);
+
+    auto status = gateway.submit(3, TCPRequest03, sizeof(TCPRequest03), 0);
+    assert(status == GatewayStatus::accepted);
+    assert(gwBusLen == sizeof(RTURequest03));
+    assert(memcmp(gwBusFrame, RTURequest03, gwBusLen) == 0);
+    assert(gateway.isBusy(0));
+}
+
+void GivenRTUResponse_WhenParsed_ReplyToClient(){
+    ModbusGateway gateway{};
+    gwSetup(gateway);
+
+    gateway.submit(3, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 5);
+    assert(gwClient == 3);
+    assert(gwClientLen == sizeof(TCPResponse03));
+    assert(memcmp(gwClientAdu, TCPResponse03, gwClientLen) == 0);
+    assert(!gateway.isBusy(0));
+    assert(gateway.queued(0) == 0);
+}
+
+void GivenQueuedRequests_WhenResponded_DispatchBackToBack(){
+    ModbusGateway gateway{};
+    gwSetup(gateway);
+
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    assert(gwBusWrites == 1);
+    assert(gateway.queued(0) == 2);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 5);
+    assert(gwBusWrites == 2);
+    assert(gateway.isBusy(0));
+}
+
+void GivenManyClients_WhenScheduled_ServeRoundRobin(){
+    ModbusGateway gateway{};
+    gwSetup(gateway);
+
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0); // on bus
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.submit(2, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 1);
+    assert(gwClient == 1);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 2);
+    assert(gwClient == 2);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 3);
+    assert(gwClient == 1);
+}
+
+void GivenClientLimit_WhenExceeded_ReplyBusy(){
+    ModbusGateway gateway{};
+    gwSetup(gateway);
+    gateway.setClientLimit(1);
+
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    auto status = gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    assert(status == GatewayStatus::clientLimit);
+    assert(gwClientAdu[7] == 0x83);
+    assert(gwClientAdu[8] == static_cast<uint8_t>(ErrorCode::slaveDeviceBusy));
+}
+
+void GivenUnsupportedFunction_WhenSubmitted_ReplyIllegalFunction(){
+    ModbusGateway gateway{};
+    gwSetup(gateway);
+
+    auto status = gateway.submit(1, TCPRequest07, sizeof(TCPRequest07), 0);
+    assert(status == GatewayStatus::illegalFunction);
+    assert(gwBusWrites == 0);
+    assert(gwClientAdu[7] == 0x87);
+}
+
+void GivenSilentSlave_WhenTimedOut_ReplyGatewayException(){
+    ModbusGateway gateway{};
+    gwSetup(gateway);
+    gateway.setTimeout(50);
+
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.poll(20);
+    assert(gwClientLen == 0);
+    gateway.poll(60);
+    assert(gwClientAdu[7] == 0x83);
+    assert(gwClientAdu[8] == static_cast<uint8_t>(ErrorCode::gatewayTargetFailed));
+    assert(!gateway.isBusy(0));
+}
+
+void GivenBroadcast_WhenTurnaroundPassed_DispatchNextWithoutReply(){
+    ModbusGateway gateway{};
+    gwSetup(gateway);
+    gateway.setTimeout(50);
+    gateway.setTurnaround(80);
+
+    gateway.submit(1, TCPBroadcast06, sizeof(TCPBroadcast06), 0);
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    assert(gwBusWrites == 1);
+    assert(gateway.isBusy(0));
+    gateway.poll(60);
+    assert(gwBusWrites == 1);
+    gateway.poll(80);
+    assert(gwClientWrites == 0);
+    assert(gwBusWrites == 2);
+    assert(memcmp(gwBusFrame, RTURequest03, sizeof(RTURequest03)) == 0);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 90);
+    assert(gwClientWrites == 1);
+    assert(memcmp(gwClientAdu, TCPResponse03, sizeof(TCPResponse03)) == 0);
+}
+
+void GivenForeignFrameError_WhenParsed_KeepWaiting(){
+    ModbusGateway gateway{};
+    gwSetup(gateway);
+
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.parse(0, RTUForeignNoise, sizeof(RTUForeignNoise), 5);
+    assert(gwClientWrites == 0);
+    assert(gateway.isBusy(0));
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 10);
+    assert(gwClientWrites == 1);
+    assert(memcmp(gwClientAdu, TCPResponse03, sizeof(TCPResponse03)) == 0);
+}
+
+void GivenResponseCRCError_WhenParsed_ReplyGatewayException(){
+    ModbusGateway gateway{};
+    gwSetup(gateway);
+    uint8_t response[sizeof(RTUResponse03)];
+    memcpy(response, RTUResponse03, sizeof(response));
+    response[sizeof(response) - 1] ^= 0xFF;
+
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.parse(0, response, sizeof(response), 5);
+    assert(gwClientWrites == 1);
+    assert(gwClientAdu[7] == 0x83);
+    assert(gwClientAdu[8] == static_cast<uint8_t>(ErrorCode::gatewayTargetFailed));
+    assert(!gateway.isBusy(0));
+}
+
+void GivenDroppedClient_WhenResponded_DoNotReply(){
+    ModbusGateway gateway{};
+    gwSetup(gateway);
+
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.dropClient(1);
+    assert(gateway.queued(0) == 1);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 5);
+    assert(gwClientLen == 0);
+    assert(gwBusWrites == 1);
+}
+
+void GivenIdenticalReads_WhenQueued_ShareOneTransaction(){
+    ModbusGateway gateway{};
+    ReadCache cache{};
+    gwSetup(gateway);
+    gateway.setCache(&cache);
+
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.submit(2, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.submit(3, TCPRequest03, sizeof(TCPRequest03), 0);
+    assert(gwBusWrites == 1);
+    assert(gateway.coalesced() == 2);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 5);
+    assert(gwClientWrites == 3);
+    assert(gwClientMask == 0x0E);
+    assert(memcmp(gwClientAdu, TCPResponse03, gwClientLen) == 0);
+    assert(gateway.queued(0) == 0);
+    assert(gwBusWrites == 1);
+}
+
+void GivenCachedRead_WhenFresh_ReplyWithoutBus(){
+    ModbusGateway gateway{};
+    ReadCache cache{};
+    cache.setTTL(1, 0x03, 0, 10, 100);
+    gwSetup(gateway);
+    gateway.setCache(&cache);
+
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 5);
+    gwClientLen = 0;
+    gateway.submit(2, TCPRequest03, sizeof(TCPRequest03), 50);
+    assert(gwBusWrites == 1);
+    assert(gwClient == 2);
+    assert(gwClientLen == sizeof(TCPResponse03));
+    assert(memcmp(gwClientAdu, TCPResponse03, gwClientLen) == 0);
+    assert(!gateway.isBusy(0));
+
+    gateway.submit(2, TCPRequest03, sizeof(TCPRequest03), 105);
+    assert(gwBusWrites == 2);
+}
+
+void GivenWrite_WhenCompleted_InvalidateCachedRead(){
+    ModbusGateway gateway{};
+    ReadCache cache{};
+    cache.setDefaultTTL(1000);
+    gwSetup(gateway);
+    gateway.setCache(&cache);
+
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 5);
+    gateway.submit(1, TCPRequest06, sizeof(TCPRequest06), 10);
+    gateway.parse(0, RTUResponse06, sizeof(RTUResponse06), 15);
+    assert(cache.entries() == 0);
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 20);
+    assert(gwBusWrites == 3);
+}
+
+void GivenQueuedWrite_WhenReadSubmitted_ReadAfterWrite(){
+    ModbusGateway gateway{};
+    ReadCache cache{};
+    cache.setDefaultTTL(1000);
+    gwSetup(gateway);
+    gateway.setCache(&cache);
+
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 5);
+    gateway.submit(2, TCPRequest03, sizeof(TCPRequest03), 6); // from the cache
+    assert(gwBusWrites == 1 && gwClientWrites == 2);
+
+    gateway.submit(1, TCPRequest06, sizeof(TCPRequest06), 10); // on bus
+    gateway.submit(1, TCPRequest03, sizeof(TCPRequest03), 10);
+    assert(gwClientWrites == 2);
+    assert(gateway.queued(0) == 2);
+    gateway.submit(2, TCPRequest03, sizeof(TCPRequest03), 10);
+    assert(gateway.coalesced() == 0);
+    assert(gateway.queued(0) == 3);
+
+    gateway.parse(0, RTUResponse06, sizeof(RTUResponse06), 15);
+    assert(gwClientWrites == 3);
+    assert(gwBusWrites == 3);
+    assert(memcmp(gwBusFrame, RTURequest03, gwBusLen) == 0);
+}
+
+void GivenSharedRead_WhenLeaderDropped_HandOver(){
+    ModbusGateway gateway{};
+    ReadCache cache{};
+    gwSetup(gateway);
+    gateway.setCache(&cache);
+
+    gateway.submit(1, TCPBroadcast06, sizeof(TCPBroadcast06), 0); // on bus
+    gateway.submit(2, TCPRequest03, sizeof(TCPRequest03), 0);
+    gateway.submit(3, TCPRequest03, sizeof(TCPRequest03), 0);
+    assert(gateway.coalesced() == 1);
+    gateway.dropClient(2);
+    gateway.poll(100);
+    assert(gwBusWrites == 2);
+    gateway.parse(0, RTUResponse03, sizeof(RTUResponse03), 10);
+    assert(gwClient == 3);
+    assert(memcmp(gwClientAdu, TCPResponse03, gwClientLen) == 0);
+    assert(gateway.queued(0) == 0);
+}
+
+void test_mbgateway(){
+    printf("\n\n -- TEST GATEWAY STARTING -- \n\n");
+    GivenTCPRequest_WhenSubmitted_WriteRTUFrame();
+    printf(".");
+    GivenRTUResponse_WhenParsed_ReplyToClient();
+    printf(".");
+    GivenQueuedRequests_WhenResponded_DispatchBackToBack();
+    printf(".");
+    GivenManyClients_WhenScheduled_ServeRoundRobin();
+    printf(".");
+    GivenClientLimit_WhenExceeded_ReplyBusy();
+    printf(".");
+    GivenUnsupportedFunction_WhenSubmitted_ReplyIllegalFunction();
+    printf(".");
+    GivenSilentSlave_WhenTimedOut_ReplyGatewayException();
+    printf(".");
+    GivenBroadcast_WhenTurnaroundPassed_DispatchNextWithoutReply();
+    printf(".");
+    GivenForeignFrameError_WhenParsed_KeepWaiting();
+    printf(".");
+    GivenResponseCRCError_WhenParsed_ReplyGatewayException();
+    printf(".");
+    GivenDroppedClient_WhenResponded_DoNotReply();
+    printf(".");
+    GivenIdenticalReads_WhenQueued_ShareOneTransaction();
+    printf(".");
+    GivenCachedRead_WhenFresh_ReplyWithoutBus();
+    printf(".");
+    GivenWrite_WhenCompleted_InvalidateCachedRead();
+    printf(".");
+    GivenQueuedWrite_WhenReadSubmitted_ReadAfterWrite();
+    printf(".");
+    GivenSharedRead_WhenLeaderDropped_HandOver();
+    printf(".");
+    printf("\nTEST DONE.");
+}
@@ -7,9 +7,13 @@ uint8_t LongResponse04[] {0x01, 0x04, 0x50, 0x40, 0x6A, 0x9F, 0xBE, 0x40, 0xF5,
 uint8_t Response06[] {0x11, 0x06, 0x00, 0x01, 0x00, 0x03, 0x9A, 0x9B};
 uint8_t Response15[] {0x11, 0x0F, 0x00, 0x01, 0x00, 0x02, 0x87, 0x5A};
 
+uint8_t Response02[] {0x08, 0x02, 0x01, 0x33, 0xE2, 0x01};
+
 uint8_t BadResponseCRC03[] {0x01, 0x03, 0x04, 0x0, 0x6,0x0, 0x05, 0xFF, 0x31};
 
-uint8_t ExceptionResponse [] {0x01, 0x82, 0x02};
+uint8_t ExceptionResponse [] {0x01, 0x82, 0x02, 0xC1, 0x61};
+uint8_t BadCRCExceptionResponse [] {0x01, 0x82, 0x02, 0xC1, 0x62};
+uint8_t ZeroCodeExceptionResponse [] {0x01, 0x83, 0x00, 0x41, 0x30};
 
 uint8_t ReadRequest01[] {0x01, 0x01, 0x00, 0x0A, 0x00, 0x0D, 0xDD, 0xCD};
 uint8_t ReadRequest04[] {0x01, 0x04, 0x01, 0x31, 0x0, 0x01E, 0x20, 0x31};
@@ -119,13 +123,67 @@ void GivenExceptionResponse_WhenParsed_CallError(){
     ResponseParser parser{};
     parser.setSlaveAddress(1);
     parser.setOnErrorCB([](ResponseParser *parser){
-        assert(parser->state() == ParserState::error);
+        assert(parser->state() == ParserState::exception);
         assert(parser->errorCode() == ErrorCode::illegalDataAddress);
 
     });
 
+    auto status = parser.parse(ExceptionResponse, 5);
+    assert(status == ParserState::exception);
+}
+
+void GivenExceptionResponse_WhenParsed_CallException(){
+    ResponseParser parser{};
+    parser.setSlaveAddress(1);
+    parser.setOnErrorCB([](ResponseParser *parser){
+        assert(false);
+    });
+    parser.setOnExceptionCB([](ResponseParser *parser){
+        assert(parser->isException());
+        assert(parser->functionCode() == 0x02);
+        assert(parser->errorCode() == ErrorCode::illegalDataAddress);
+    });
+
     auto status = parser.parse(ExceptionResponse, 3);
+    assert(status == ParserState::firstCRC);
+    status = parser.parse(ExceptionResponse + 3, 2);
+    assert(status == ParserState::exception);
+}
+
+void GivenBadCRCException_WhenParsed_ReturnError(){
+    ResponseParser parser{};
+    parser.setSlaveAddress(1);
+
+    auto status = parser.parse(BadCRCExceptionResponse, 5);
     assert(status == ParserState::error);
+    assert(parser.errorCode() == ErrorCode::CRCError);
+}
+
+void GivenExceptionCodeZero_WhenParsed_ReturnException(){
+    ResponseParser parser{};
+    parser.setSlaveAddress(1);
+
+    auto status = parser.parse(ZeroCodeExceptionResponse, 5);
+    assert(status == ParserState::exception);
+    assert(parser.isException());
+    assert(parser.isError());
+    assert(parser.functionCode() == 0x03);
+    assert(parser.errorCode() == ErrorCode::noError);
+}
+
+void GivenExceptionResponse_WhenFollowedByFrame_KeepAlignment(){
+    // the first CRC byte of the exception equals the slave address
+    uint8_t stream[] {0x01, 0x83, 0x03, 0x01, 0x31, 0x01, 0x03, 0x02, 0x00, 0x07, 0xF9, 0x86};
+    ResponseParser parser{};
+    parser.setSlaveAddress(1);
+
+    auto status = parser.parse(stream, 5);
+    assert(status == ParserState::exception);
+    status = parser.parse(stream + 5, 7);
+    assert(status == ParserState::complete);
+    assert(!parser.isError());
+    assert(parser.byteCount() == 2);
+    assert(parser.data()[1] == 0x07);
 }
 
 void GivenReadRequest01_WhenParsed_ReturnProperties(){
@@ -244,6 +302,16 @@ void GivenResponse15_WhenParsed_ReturnProperties(){
     assert(status == ParserState::complete);
 }
 
+void GivenResponse02_WhenOneByte_ReturnComplete(){
+    ResponseParser parser{};
+    parser.setSlaveAddress(0);
+
+    auto status = parser.parse(Response02, 6);
+    assert(status == ParserState::complete);
+    assert(parser.byteCount() == 1);
+    assert(parser.data()[0] == 0x33);
+}
+
 void GivenLongResponse_WhenParsed_ReturnWithError(){
     ResponseParser parser{};
     parser.setSlaveAddress(0);
@@ -253,6 +321,182 @@ void GivenLongResponse_WhenParsed_ReturnWithError(){
     assert(parser.errorCode()==ErrorCode::illegalDataValue);
 }
 
+uint8_t demuxCalls[2]{};
+
+void GivenSlaveTable_WhenParsed_CallSlaveHandler(){
+    RequestParser parser{};
+    demuxCalls[0] = 0;
+    demuxCalls[1] = 0;
+    parser.setSlaveHandler(0x01, [](RequestParser *parser){
+        assert(parser->slaveAddress() == 0x01);
+        demuxCalls[0]++;
+    });
+    parser.setSlaveHandler(0x11, [](RequestParser *parser){
+        assert(parser->slaveAddress() == 0x11);
+        assert(parser->functionCode() == 0x06);
+        demuxCalls[1]++;
+    });
+
+    parser.parse(WriteRequest16, 13);
+    parser.parse(Response06, 8);
+    auto status = parser.parse(ReadRequest01, 8);
+    assert(status == ParserState::complete);
+    assert(demuxCalls[0] == 2);
+    assert(demuxCalls[1] == 1);
+}
+
+void GivenDisabledSlave_WhenParsed_SkipFrame(){
+    RequestParser parser{};
+    demuxCalls[1] = 0;
+    parser.setSlaveHandler(0x11, [](RequestParser *parser){
+        demuxCalls[1]++;
+    });
+    parser.setSlaveHandler(0x01, nullptr);
+    parser.setSlaveEnabled(0x01, false);
+    assert(!parser.isSlaveEnabled(0x01));
+    assert(parser.isSlaveEnabled(0x11));
+
+    auto status = parser.parse(ReadRequest01, 8);
+    assert(status == ParserState::slaveAddress);
+    status = parser.parse(Response06, 8);
+    assert(status == ParserState::complete);
+    assert(demuxCalls[1] == 1);
+}
+
+void GivenSlaveSettings_WhenParsed_ApplyPerFrame(){
+    ResponseParser parser{};
+    parser.setSlaveEnabled(0x01, true);
+    parser.setSlaveEnabled(0x08, true);
+    parser.setSlaveSwap(0x01, true, 2);
+
+    auto status = parser.parse(GoodResponse03, 9);
+    assert(status == ParserState::complete);
+    assert(parser.data()[0] == 0x06 && parser.data()[1] == 0x00);
+    status = parser.parse(Response02, 6);
+    assert(status == ParserState::complete);
+    assert(parser.data()[0] == 0x33);
+
+    parser.setSlaveByteCountLimit(0x01, 2);
+    status = parser.parse(GoodResponse03, 9);
+    assert(status == ParserState::error);
+    assert(parser.errorCode() == ErrorCode::illegalDataValue);
+    parser.reset();
+    status = parser.parse(Response02, 6);
+    assert(status == ParserState::complete);
+
+    parser.clearSlaveTable();
+    status = parser.parse(GoodResponse03, 9);
+    assert(status == ParserState::complete);
+    assert(parser.data()[0] == 0x00);
+}
+
+uint8_t streamFrame[255];
+uint16_t streamChunks{0};
+uint16_t streamBytes{0};
+uint32_t streamSum{0};
+bool streamCommitted{false};
+bool streamRolledBack{false};
+
+void streamCollect(ResponseParser *parser, const uint8_t *data, uint16_t len, uint16_t offset){
+    assert(offset == streamBytes);
+    for (uint16_t idx = 0; idx < len; idx++){
+        streamSum += data[idx];
+    }
+    streamBytes += len;
+    streamChunks++;
+}
+
+void streamReset(ResponseParser &parser){
+    streamChunks = 0;
+    streamBytes = 0;
+    streamSum = 0;
+    streamCommitted = false;
+    streamRolledBack = false;
+    parser.setOnDataCB(streamCollect);
+    parser.setOnCompleteCB([](ResponseParser *parser){ streamCommitted = true; });
+    parser.setOnErrorCB([](ResponseParser *parser){ streamRolledBack = true; });
+}
+
+uint16_t streamBuildFrame(){
+    streamFrame[0] = 0x01;
+    streamFrame[1] = 0x03;
+    streamFrame[2] = 250;
+    for (uint16_t idx = 0; idx < 250; idx++){
+        streamFrame[3 + idx] = idx;
+    }
+    uint16_t crc = 0xFFFF;
+    for (uint16_t idx = 0; idx < 253; idx++){
+        crc = modbusCRC(crc, streamFrame[idx]);
+    }
+    streamFrame[253] = lowByte(crc);
+    streamFrame[254] = highByte(crc);
+    return 255;
+}
+
+void GivenStreamingMode_WhenParsedAsBuffer_DeliverOneChunk(){
+    ResponseParser parser{};
+    streamReset(parser);
+    uint16_t len = streamBuildFrame();
+
+    auto status = parser.parse(streamFrame, len);
+    assert(status == ParserState::complete);
+    assert(parser.isStreaming());
+    assert(parser.data() == nullptr);
+    assert(streamChunks == 1);
+    assert(streamBytes == 250);
+    assert(streamSum == 249 * 250 / 2);
+    assert(streamCommitted && !streamRolledBack);
+}
+
+void GivenStreamingMode_WhenParsedByToken_DeliverEachByte(){
+    ResponseParser parser{};
+    streamReset(parser);
+    uint16_t len = streamBuildFrame();
+
+    ParserState status{ParserState::slaveAddress};
+    for (uint16_t idx = 0; idx < len; idx++){
+        status = parser.parse(streamFrame[idx]);
+    }
+    assert(status == ParserState::complete);
+    assert(streamChunks == 250);
+    assert(streamSum == 249 * 250 / 2);
+    assert(streamCommitted);
+}
+
+void GivenStreamingMode_WhenCRCFails_RollBack(){
+    ResponseParser parser{};
+    streamReset(parser);
+
+    auto status = parser.parse(BadResponseCRC03, 9);
+    assert(status == ParserState::error);
+    assert(streamBytes == 4);
+    assert(streamRolledBack && !streamCommitted);
+}
+
+void GivenStreamingMode_WhenWriteSingle_DeliverValue(){
+    ResponseParser parser{};
+    streamReset(parser);
+
+    auto status = parser.parse(Response06, 8);
+    assert(status == ParserState::complete);
+    assert(streamBytes == 2);
+    assert(streamSum == 0x03);
+    assert(parser.address() == 1);
+}
+
+void GivenStreamingMode_WhenWriteSingleByToken_DeliverValue(){
+    ResponseParser parser{};
+    streamReset(parser);
+
+    ParserState status{ParserState::slaveAddress};
+    for (uint16_t idx = 0; idx < 8; idx++){
+        status = parser.parse(Response06[idx]);
+    }
+    assert(status == ParserState::complete);
+    assert(streamChunks == 2);
+    assert(streamSum == 0x03);
+}
+
 // Profile tests
 void profile_throughput_small(){
     Serial.print("\n\n");
@@ -321,6 +565,14 @@ void test_mbparser(){
     printf(".");
     GivenExceptionResponse_WhenParsed_CallError();
     printf(".");
+    GivenExceptionResponse_WhenParsed_CallException();
+    printf(".");
+    GivenBadCRCException_WhenParsed_ReturnError();
+    printf(".");
+    GivenExceptionCodeZero_WhenParsed_ReturnException();
+    printf(".");
+    GivenExceptionResponse_WhenFollowedByFrame_KeepAlignment();
+    printf(".");
     GivenReadRequest01_WhenParsed_ReturnProperties();
     printf(".");
     GivenWriteRequest05_WhenParsed_ReturnProperties();
@@ -335,8 +587,26 @@ void test_mbparser(){
     printf(".");
     GivenResponse15_WhenParsed_ReturnProperties();
     printf(".");
+    GivenResponse02_WhenOneByte_ReturnComplete();
+    printf(".");
     GivenLongResponse_WhenParsed_ReturnWithError();
     printf(".");
+    GivenSlaveTable_WhenParsed_CallSlaveHandler();
+    printf(".");
+    GivenDisabledSlave_WhenParsed_SkipFrame();
+    printf(".");
+    GivenSlaveSettings_WhenParsed_ApplyPerFrame();
+    printf(".");
+    GivenStreamingMode_WhenParsedAsBuffer_DeliverOneChunk();
+    printf(".");
+    GivenStreamingMode_WhenParsedByToken_DeliverEachByte();
+    printf(".");
+    GivenStreamingMode_WhenCRCFails_RollBack();
+    printf(".");
+    GivenStreamingMode_WhenWriteSingle_DeliverValue();
+    printf(".");
+    GivenStreamingMode_WhenWriteSingleByToken_DeliverValue();
+    printf(".");
     heapSize -= ESP.getFreeHeap();
     if (heapSize >0){
         printf("Memory Leak: %d bytes\n", heapSize);
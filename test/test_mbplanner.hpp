@@ -0,0 +1,125 @@
+#include "Arduino.h"
+#include "mbplanner.h"
+
+uint8_t PlannerRequest04[] {0x01, 0x04, 0x00, 0x00, 0x00, 0x06, 0x70, 0x08};
+uint8_t PlannerResponse03[] {0x01, 0x03, 0x04, 0x0, 0x6, 0x0, 0x05, 0xDA, 0x31};
+
+uint8_t plannerCalls{0};
+uint16_t plannerValues[4];
+
+void plannerCollect(PollPlanner *planner, uint8_t interest, uint16_t address, const uint8_t *data, uint16_t quantity){
+    assert(quantity == 1);
+    plannerValues[interest] = ModbusFrame::getWord(data);
+    plannerCalls++;
+}
+
+void GivenAdjacentInterests_WhenPlanned_MergeIntoOneRequest(){
+    PollPlanner planner{};
+    planner.add(1, 0x04, 4, 2);
+    planner.add(1, 0x04, 0, 2);
+
+    assert(planner.plan() == 1);
+    assert(planner.request(0).address == 0);
+    assert(planner.request(0).quantity == 6);
+    assert(memcmp(planner.request(0).frame, PlannerRequest04, 8) == 0);
+}
+
+void GivenNearInterests_WhenPlanned_MergeWithinGap(){
+    PollPlanner planner{};
+    planner.setMaxGap(8);
+    planner.add(1, 0x04, 0, 2);
+    planner.add(1, 0x04, 10, 2);
+    planner.add(1, 0x04, 100, 2);
+
+    assert(planner.plan() == 2);
+    assert(planner.request(0).quantity == 12);
+    assert(planner.request(1).address == 100);
+}
+
+void GivenDifferentSlaves_WhenPlanned_DoNotMerge(){
+    PollPlanner planner{};
+    planner.add(2, 0x04, 0, 2);
+    planner.add(1, 0x04, 2, 2);
+    planner.add(1, 0x03, 2, 2);
+
+    assert(planner.plan() == 3);
+    assert(planner.request(0).slave == 1);
+    assert(planner.request(0).functionCode == 0x03);
+    assert(planner.request(2).slave == 2);
+}
+
+void GivenByteCountLimit_WhenPlanned_SplitRequests(){
+    PollPlanner planner{};
+    planner.setByteCountLimit(8);
+    planner.add(1, 0x03, 0, 10);
+
+    assert(planner.plan() == 3);
+    assert(planner.request(0).quantity == 4);
+    assert(planner.request(1).address == 4);
+    assert(planner.request(2).quantity == 2);
+}
+
+void GivenTooManyPollRequests_WhenPlanned_ReturnFailure(){
+    PollPlanner planner{};
+    assert(planner.plan() == 0);
+    planner.setByteCountLimit(2);
+    for (uint8_t idx = 0; idx <= MBPLANNER_MAX_REQUESTS / 2; idx++){
+        planner.add(1, 0x03, 100 * idx, 2);
+    }
+    assert(planner.plan() == -1);
+    assert(planner.requests() == 0);
+}
+
+void GivenUnsupportedFunction_WhenAdded_Reject(){
+    PollPlanner planner{};
+    assert(planner.add(1, 0x01, 0, 2) == -1);
+    assert(planner.add(1, 0x03, 0, 0) == -1);
+    assert(planner.interests() == 0);
+}
+
+void GivenResponse_WhenCompleted_MapToInterests(){
+    PollPlanner planner{};
+    ResponseParser parser{};
+    plannerCalls = 0;
+    planner.setOnRegisterCB(plannerCollect);
+    planner.add(1, 0x03, 1, 1);
+    planner.add(1, 0x03, 0, 1);
+    planner.plan();
+
+    parser.parse(PlannerResponse03, 9);
+    assert(planner.complete(0, parser));
+    assert(plannerCalls == 2);
+    assert(plannerValues[0] == 0x0005);
+    assert(plannerValues[1] == 0x0006);
+}
+
+void GivenForeignResponse_WhenCompleted_ReturnFalse(){
+    PollPlanner planner{};
+    ResponseParser parser{};
+    planner.add(1, 0x04, 0, 2);
+    planner.plan();
+
+    parser.parse(PlannerResponse03, 9);
+    assert(!planner.complete(0, parser));
+}
+
+void test_mbplanner(){
+    printf("\n\n -- TEST PLANNER STARTING -- \n\n");
+    GivenAdjacentInterests_WhenPlanned_MergeIntoOneRequest();
+    printf(".");
+    GivenNearInterests_WhenPlanned_MergeWithinGap();
+    printf(".");
+    GivenDifferentSlaves_WhenPlanned_DoNotMerge();
+    printf(".");
+    GivenByteCountLimit_WhenPlanned_SplitRequests();
+    printf(".");
+    GivenTooManyPollRequests_WhenPlanned_ReturnFailure();
+    printf(".");
+    GivenUnsupportedFunction_WhenAdded_Reject();
+    printf(".");
+    GivenResponse_WhenCompleted_MapToInterests();
+    printf(".");
+    GivenForeignResponse_WhenCompleted_ReturnFalse();
+    printf(".");
+    printf("\nTEST DONE.");
+}
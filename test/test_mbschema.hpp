@@ -0,0 +1,165 @@
+#include "Arduino.h"
+#include "mbschema.h"
+
+// SDM72D: voltage 230.0 at 0x0000, power 1150.5 at 0x000C
+uint8_t SchemaRequest04[] {0x01, 0x04, 0x00, 0x00, 0x00, 0x0E, 0x71, 0xCE};
+
+struct SchemaMeter{
+    float voltage;
+    float power;
+};
+
+typedef RegisterSchema<SchemaMeter, 0x04,
+    MB_FIELD(SchemaMeter, voltage, 0x0000, RegisterType::float32),
+    MB_FIELD(SchemaMeter, power, 0x000C, RegisterType::float32)
+> SchemaMeterMap;
+
+struct SchemaDrive{
+    int32_t position;
+    uint32_t hours;
+    float temperature;
+    int16_t torque;
+    uint16_t status;
+};
+
+typedef RegisterSchema<SchemaDrive, 0x03,
+    MB_FIELD(SchemaDrive, position, 10, RegisterType::int32, WordOrder::lowFirst),
+    MB_FIELD(SchemaDrive, hours, 12, RegisterType::uint32),
+    MB_FIELD(SchemaDrive, temperature, 14, RegisterType::int16, WordOrder::highFirst, 1, 10),
+    MB_FIELD(SchemaDrive, torque, 15, RegisterType::int16, WordOrder::highFirst, 2, 1),
+    MB_FIELD(SchemaDrive, status, 300, RegisterType::uint16)
+> SchemaDriveMap;
+
+void GivenSchema_WhenCompiled_ResolveRequests(){
+    static_assert(SchemaMeterMap::first() == 0, "first");
+    static_assert(SchemaMeterMap::requests() == 1, "requests");
+    static_assert(SchemaMeterMap::requestQuantity(0) == 14, "quantity");
+    static_assert(SchemaMeterMap::maxByteCount() == 28, "byte count");
+    static_assert(SchemaDriveMap::requests() == 2, "split at gap");
+    static_assert(SchemaDriveMap::maxByteCount() == 12, "byte count");
+
+    uint8_t frame[8];
+    assert(SchemaMeterMap::request(0, 1, frame) == 8);
+    assert(memcmp(frame, SchemaRequest04, 8) == 0);
+
+    assert(SchemaDriveMap::requestAddress(0) == 10);
+    assert(SchemaDriveMap::requestQuantity(0) == 6);
+    assert(SchemaDriveMap::requestAddress(1) == 300);
+    assert(SchemaDriveMap::requestQuantity(1) == 1);
+    assert(SchemaDriveMap::request(1, 1, frame) == 8);
+    assert(ModbusFrame::getWord(frame + 2) == 300 && ModbusFrame::getWord(frame + 4) == 1);
+}
+
+struct SchemaTable{
+    uint16_t a, b, c, d, e, f, g, h;
+    uint32_t i;
+    uint16_t j;
+};
+
+// fields every 16 registers, the 32 bit field at 124 would end beyond the request limit
+typedef RegisterSchema<SchemaTable, 0x03,
+    MB_FIELD(SchemaTable, a, 0, RegisterType::uint16),
+    MB_FIELD(SchemaTable, b, 16, RegisterType::uint16),
+    MB_FIELD(SchemaTable, c, 32, RegisterType::uint16),
+    MB_FIELD(SchemaTable, d, 48, RegisterType::uint16),
+    MB_FIELD(SchemaTable, e, 64, RegisterType::uint16),
+    MB_FIELD(SchemaTable, f, 80, RegisterType::uint16),
+    MB_FIELD(SchemaTable, g, 96, RegisterType::uint16),
+    MB_FIELD(SchemaTable, h, 112, RegisterType::uint16),
+    MB_FIELD(SchemaTable, i, 124, RegisterType::uint32),
+    MB_FIELD(SchemaTable, j, 140, RegisterType::uint16)
+> SchemaTableMap;
+
+void GivenLongCluster_WhenCompiled_SplitAtRequestLimit(){
+    static_assert(SchemaTableMap::requests() == 2, "split at limit");
+    static_assert(SchemaTableMap::requestAddress(0) == 0 && SchemaTableMap::requestQuantity(0) == 113, "first");
+    static_assert(SchemaTableMap::requestAddress(1) == 124 && SchemaTableMap::requestQuantity(1) == 17, "second");
+}
+
+void GivenFloatResponse_WhenDecoded_FillStruct(){
+    uint8_t data[28]{};
+    data[0] = 0x43; data[1] = 0x66;                      // 230.0
+    data[24] = 0x44; data[25] = 0x8F; data[26] = 0xD0;   // 1150.5
+    uint8_t frame[MB_RTU_MAX_ADU];
+    uint16_t len = ModbusFrame::readResponse(frame, 1, 0x04, data, 28);
+
+    ResponseParser parser{};
+    parser.setByteCountLimit(SchemaMeterMap::maxByteCount());
+    parser.parse(frame, len);
+
+    SchemaMeter meter{};
+    assert(SchemaMeterMap::decode(0, parser, meter));
+    assert(meter.voltage == 230.0f);
+    assert(meter.power == 1150.5f);
+}
+
+void GivenMixedTypes_WhenDecoded_ApplyWordOrderAndScale(){
+    uint8_t data[12]{};
+    uint8_t fields[] {0xFF, 0xFE, 0xFF, 0xFF,  // -2 low word first
+                      0x00, 0x01, 0x00, 0x02,  // 65538
+                      0xFF, 0x06,              // -25.0
+                      0x00, 0x07};             // 14
+    memcpy(data, fields, sizeof(fields));
+    uint8_t frame[MB_RTU_MAX_ADU];
+    uint16_t len = ModbusFrame::readResponse(frame, 1, 0x03, data, sizeof(data));
+
+    ResponseParser parser{};
+    parser.setByteCountLimit(SchemaDriveMap::maxByteCount());
+    parser.parse(frame, len);
+
+    SchemaDrive drive{};
+    drive.status = 0x55;
+    assert(SchemaDriveMap::decode(0, parser, drive));
+    assert(drive.position == -2);
+    assert(drive.hours == 65538);
+    assert(drive.temperature == -25.0f);
+    assert(drive.torque == 14);
+    // not part of the first request
+    assert(drive.status == 0x55);
+}
+
+void GivenLastRequest_WhenDecoded_FillRemainingFields(){
+    uint8_t data[2] {0x12, 0x34};
+    uint8_t frame[MB_RTU_MAX_ADU];
+    uint16_t len = ModbusFrame::readResponse(frame, 1, 0x03, data, sizeof(data));
+
+    ResponseParser parser{};
+    parser.parse(frame, len);
+
+    SchemaDrive drive{};
+    assert(!SchemaDriveMap::decode(0, parser, drive));
+    assert(!SchemaDriveMap::decode(2, parser, drive));
+    assert(SchemaDriveMap::decode(1, parser, drive));
+    assert(drive.status == 0x1234);
+    assert(drive.position == 0);
+}
+
+void GivenForeignResponse_WhenDecoded_ReturnFalse(){
+    uint8_t data[28]{};
+    uint8_t frame[MB_RTU_MAX_ADU];
+    uint16_t len = ModbusFrame::readResponse(frame, 1, 0x03, data, 28);
+
+    ResponseParser parser{};
+    parser.parse(frame, len);
+
+    SchemaMeter meter{};
+    assert(!SchemaMeterMap::decode(0, parser, meter));
+    assert(!SchemaMeterMap::decode(1, parser, meter));
+}
+
+void test_mbschema(){
+    printf("\n\n -- TEST SCHEMA STARTING -- \n\n");
+    GivenSchema_WhenCompiled_ResolveRequests();
+    printf(".");
+    GivenLongCluster_WhenCompiled_SplitAtRequestLimit();
+    printf(".");
+    GivenFloatResponse_WhenDecoded_FillStruct();
+    printf(".");
+    GivenMixedTypes_WhenDecoded_ApplyWordOrderAndScale();
+    printf(".");
+    GivenLastRequest_WhenDecoded_FillRemainingFields();
+    printf(".");
+    GivenForeignResponse_WhenDecoded_ReturnFalse();
+    printf(".");
+    printf("\nTEST DONE.");
+}
@@ -0,0 +1,212 @@
+#include "Arduino.h"
+#include "mbsim.h"
+
+uint8_t simFrame[MB_RTU_MAX_ADU];
+uint8_t simResponse[MB_RTU_MAX_ADU];
+uint16_t simResponseLen{0};
+
+void simWriter(SlaveSimulator *simulator, const uint8_t *frame, uint16_t len){
+    memcpy(simResponse, frame, len);
+    simResponseLen = len;
+}
+
+void GivenSameSeed_WhenGenerated_ReturnSameTraffic(){
+    TrafficGenerator a{42};
+    TrafficGenerator b{42};
+    uint8_t other[MB_RTU_MAX_ADU];
+    GeneratedFrame frame;
+    a.setFaultRate(FrameFault::crcError, 100);
+    b.setFaultRate(FrameFault::crcError, 100);
+
+    for (uint16_t i = 0; i < 100; i++){
+        uint16_t len = a.next(simFrame, frame);
+        assert(b.next(other, frame) == len);
+        assert(memcmp(simFrame, other, len) == 0);
+    }
+}
+
+void GivenGeneratedResponses_WhenParsed_ReturnComplete(){
+    TrafficGenerator generator{7};
+    ResponseParser parser{};
+    GeneratedFrame frame;
+    generator.setSlaves(1, 10);
+
+    for (uint16_t i = 0; i < 1000; i++){
+        uint16_t len = generator.next(simFrame, frame);
+        assert(!frame.request);
+        assert(parser.parse(simFrame, len) == ParserState::complete);
+        assert(parser.slaveAddress() == frame.slave);
+        assert(parser.functionCode() == frame.functionCode);
+    }
+}
+
+void GivenGeneratedRequests_WhenParsed_ReturnComplete(){
+    TrafficGenerator generator{7};
+    RequestParser parser{};
+    GeneratedFrame frame;
+    generator.setMode(TrafficMode::requests);
+
+    for (uint16_t i = 0; i < 1000; i++){
+        uint16_t len = generator.next(simFrame, frame);
+        assert(frame.request);
+        assert(parser.parse(simFrame, len) == ParserState::complete);
+        assert(parser.address() == frame.address);
+    }
+}
+
+void GivenCRCFaults_WhenParsed_ReturnCRCError(){
+    TrafficGenerator generator{3};
+    ResponseParser parser{};
+    GeneratedFrame frame;
+    generator.setFaultRate(FrameFault::crcError, 1000);
+
+    for (uint16_t i = 0; i < 100; i++){
+        uint16_t len = generator.next(simFrame, frame);
+        assert(frame.fault == FrameFault::crcError);
+        assert(parser.parse(simFrame, len) == ParserState::error);
+        assert(parser.errorCode() == ErrorCode::CRCError);
+    }
+}
+
+void GivenForeignSlaves_WhenParsed_Ignore(){
+    TrafficGenerator generator{5};
+    ResponseParser parser{};
+    GeneratedFrame frame;
+    parser.setSlaveAddress(1);
+    generator.setFaultRate(FrameFault::foreignSlave, 500);
+
+    for (uint16_t i = 0; i < 100; i++){
+        generator.next(simFrame, frame);
+        if (frame.fault == FrameFault::foreignSlave){
+            assert(frame.slave != 1);
+            // payload bytes may look like a start of frame, only check the address
+            assert(parser.parse(simFrame, 1) == ParserState::slaveAddress);
+            parser.reset();
+        }
+    }
+}
+
+void GivenWriteThenRead_WhenSimulated_ReturnWrittenRegisters(){
+    SlaveSimulator simulator{1};
+    ResponseParser parser{};
+    uint8_t values[4] {0x12, 0x34, 0x56, 0x78};
+    simulator.setWriter(simWriter);
+
+    uint16_t len = ModbusFrame::writeMultiple(simFrame, 1, 0x10, 10, 2, values, 4);
+    simulator.parse(simFrame, len);
+    assert(parser.parse(simResponse, simResponseLen) == ParserState::complete);
+    assert(parser.quantity() == 2);
+    assert(simulator.getRegister(11) == 0x5678);
+
+    len = ModbusFrame::readRequest(simFrame, 1, 0x03, 10, 2);
+    simulator.parse(simFrame, len);
+    assert(parser.parse(simResponse, simResponseLen) == ParserState::complete);
+    assert(parser.byteCount() == 4);
+    assert(memcmp(parser.data(), values, 4) == 0);
+}
+
+void GivenCoils_WhenSimulated_ReturnPackedBits(){
+    SlaveSimulator simulator{1};
+    ResponseParser parser{};
+    simulator.setWriter(simWriter);
+    simulator.setCoil(3, true);
+    simulator.setCoil(9, true);
+
+    uint16_t len = ModbusFrame::readRequest(simFrame, 1, 0x01, 0, 10);
+    simulator.parse(simFrame, len);
+    assert(parser.parse(simResponse, simResponseLen) == ParserState::complete);
+    assert(parser.byteCount() == 2);
+    assert(parser.data()[0] == 0x08);
+    assert(parser.data()[1] == 0x02);
+}
+
+void GivenOutOfRange_WhenSimulated_ReturnException(){
+    SlaveSimulator simulator{1};
+    ResponseParser parser{};
+    simulator.setWriter(simWriter);
+
+    uint16_t len = ModbusFrame::readRequest(simFrame, 1, 0x03, MBSIM_REGISTERS, 1);
+    simulator.parse(simFrame, len);
+    assert(simResponse[1] == 0x83);
+    assert(simResponse[2] == static_cast<uint8_t>(ErrorCode::illegalDataAddress));
+    assert(simulator.exceptions() == 1);
+}
+
+void GivenTooManyBits_WhenSimulated_ReturnIllegalDataValue(){
+    SlaveSimulator simulator{1};
+    simulator.setWriter(simWriter);
+
+    uint16_t len = ModbusFrame::readRequest(simFrame, 1, 0x01, 0, MB_MAX_READ_BITS + 1);
+    simulator.parse(simFrame, len);
+    assert(simResponse[1] == 0x81);
+    assert(simResponse[2] == static_cast<uint8_t>(ErrorCode::illegalDataValue));
+
+    len = ModbusFrame::readRequest(simFrame, 1, 0x03, 0, MB_MAX_READ_REGISTERS + 1);
+    simulator.parse(simFrame, len);
+    assert(simResponse[1] == 0x83);
+    assert(simResponse[2] == static_cast<uint8_t>(ErrorCode::illegalDataValue));
+    assert(simulator.exceptions() == 2);
+}
+
+// Profile tests
+void profile_throughput_mixed(){
+    Serial.print("\n\n");
+    ESP.wdtDisable();
+    const uint16_t frames{1000};
+    const uint32_t repeats{100};
+    uint8_t *traffic = new uint8_t[frames * 40];
+    uint32_t trafficLen = 0;
+    TrafficGenerator generator{1};
+    GeneratedFrame frame;
+    generator.setSlaves(1, 4);
+    generator.setByteCountLimit(32);
+    generator.setFaultRate(FrameFault::crcError, 10);
+    generator.setFaultRate(FrameFault::exception, 10);
+    generator.setFaultRate(FrameFault::foreignSlave, 50);
+    for (uint16_t i = 0; i < frames; i++){
+        trafficLen += generator.next(traffic + trafficLen, frame);
+    }
+    ResponseParser parser{};
+    parser.setSlaveAddress(1);
+
+    unsigned long time = millis();
+    for (unsigned long i = 0; i < repeats; i++){
+        // token wise, as parse(buffer, len) stops at the first faulty frame
+        for (uint32_t idx = 0; idx < trafficLen; idx++){
+            parser.parse(traffic[idx]);
+        }
+        parser.reset();
+    }
+    time = millis() - time;
+    delete[] traffic;
+    float tp = float(repeats) * trafficLen / 1000; // kb
+    tp /= 1000; // mb
+    tp /= time / 1000.0f; // s
+    Serial.printf("Mixed traffic: %lu bytes\n", trafficLen);
+    Serial.printf("Time took: %lu ms\n", time);
+    Serial.printf("Throughput: %.2f mb/s\n", tp);
+}
+
+void test_mbsim(){
+    printf("\n\n -- TEST SIMULATOR STARTING -- \n\n");
+    GivenSameSeed_WhenGenerated_ReturnSameTraffic();
+    printf(".");
+    GivenGeneratedResponses_WhenParsed_ReturnComplete();
+    printf(".");
+    GivenGeneratedRequests_WhenParsed_ReturnComplete();
+    printf(".");
+    GivenCRCFaults_WhenParsed_ReturnCRCError();
+    printf(".");
+    GivenForeignSlaves_WhenParsed_Ignore();
+    printf(".");
+    GivenWriteThenRead_WhenSimulated_ReturnWrittenRegisters();
+    printf(".");
+    GivenCoils_WhenSimulated_ReturnPackedBits();
+    printf(".");
+    GivenOutOfRange_WhenSimulated_ReturnException();
+    printf(".");
+    GivenTooManyBits_WhenSimulated_ReturnIllegalDataValue();
+    printf(".");
+    printf("\nTEST DONE.");
+    profile_throughput_mixed();
+}
@@ -0,0 +1,169 @@
+#include "Arduino.h"
+#include "mbsniffer.h"
+#include "mbsim.h"
+
+uint8_t SnifferRequest04[] {0x01, 0x04, 0x01, 0x31, 0x0, 0x01E, 0x20, 0x31};
+uint8_t SnifferRequest03[] {0x01, 0x03, 0x00, 0x00, 0x00, 0x02, 0xC4, 0x0B};
+uint8_t SnifferResponse03[] {0x01, 0x03, 0x04, 0x0, 0x6, 0x0, 0x05, 0xDA, 0x31};
+uint8_t SnifferRequest06[] {0x11, 0x06, 0x00, 0x01, 0x00, 0x03, 0x9A, 0x9B};
+uint8_t SnifferException[] {0x01, 0x83, 0x02, 0xC0, 0xF1};
+
+uint16_t snifferCount{0};
+SniffedTransaction snifferLast{};
+GeneratedFrame snifferExpected{};
+bool snifferMismatch{false};
+
+void snifferCollect(BusSniffer *sniffer, const SniffedTransaction &transaction, ResponseParser *response){
+    snifferLast = transaction;
+    snifferCount++;
+}
+
+void snifferCompare(BusSniffer *sniffer, const SniffedTransaction &transaction, ResponseParser *response){
+    snifferCount++;
+    if (!transaction.hasRequest || !transaction.hasResponse
+        || transaction.slave != snifferExpected.slave
+        || transaction.functionCode != snifferExpected.functionCode
+        || transaction.address != snifferExpected.address){
+        snifferMismatch = true;
+    }
+}
+
+void GivenRequestAndResponse_WhenSniffed_ReturnPairedTransaction(){
+    BusSniffer sniffer{};
+    snifferCount = 0;
+    sniffer.setOnTransactionCB(snifferCollect);
+
+    sniffer.parse(SnifferRequest03, sizeof(SnifferRequest03), 100);
+    assert(sniffer.isPending());
+    sniffer.parse(SnifferResponse03, sizeof(SnifferResponse03), 125);
+    assert(snifferCount == 1);
+    assert(snifferLast.hasRequest && snifferLast.hasResponse);
+    assert(snifferLast.slave == 1);
+    assert(snifferLast.functionCode == 0x03);
+    assert(snifferLast.quantity == 2);
+    assert(snifferLast.latency == 25);
+}
+
+void GivenEcho_WhenSniffed_DecideByPreviousRequest(){
+    BusSniffer sniffer{};
+    snifferCount = 0;
+    sniffer.setOnTransactionCB(snifferCollect);
+
+    sniffer.parse(SnifferRequest06, sizeof(SnifferRequest06), 0);
+    assert(snifferCount == 0);
+    assert(sniffer.requests() == 1);
+    sniffer.parse(SnifferRequest06, sizeof(SnifferRequest06), 10);
+    assert(snifferCount == 1);
+    assert(snifferLast.hasResponse);
+    assert(snifferLast.address == 0x0001);
+    assert(sniffer.responses() == 1);
+}
+
+void GivenException_WhenSniffed_ReturnException(){
+    BusSniffer sniffer{};
+    snifferCount = 0;
+    sniffer.setOnTransactionCB(snifferCollect);
+
+    sniffer.parse(SnifferRequest03, sizeof(SnifferRequest03), 0);
+    sniffer.parse(SnifferException, sizeof(SnifferException), 5);
+    assert(snifferCount == 1);
+    assert(snifferLast.exception == ErrorCode::illegalDataAddress);
+    // next transaction is still aligned
+    sniffer.parse(SnifferRequest03, sizeof(SnifferRequest03), 10);
+    sniffer.parse(SnifferResponse03, sizeof(SnifferResponse03), 15);
+    assert(snifferCount == 2);
+    assert(snifferLast.exception == ErrorCode::noError);
+}
+
+void GivenExceptionWithoutRequest_WhenSniffed_ReportResponseOnly(){
+    BusSniffer sniffer{};
+    snifferCount = 0;
+    sniffer.setOnTransactionCB(snifferCollect);
+
+    sniffer.parse(SnifferException, sizeof(SnifferException), 5);
+    assert(snifferCount == 1);
+    assert(!snifferLast.hasRequest && snifferLast.hasResponse);
+    assert(snifferLast.slave == 1);
+    assert(snifferLast.functionCode == 0x03);
+    assert(snifferLast.exception == ErrorCode::illegalDataAddress);
+    assert(sniffer.responses() == 1);
+
+    // exception of another slave while a request is outstanding
+    sniffer.parse(SnifferRequest06, sizeof(SnifferRequest06), 10);
+    sniffer.parse(SnifferException, sizeof(SnifferException), 15);
+    assert(snifferCount == 3);
+    assert(sniffer.unanswered() == 1);
+    assert(!snifferLast.hasRequest);
+    assert(snifferLast.exception == ErrorCode::illegalDataAddress);
+    assert(!sniffer.isPending());
+}
+
+void GivenUnansweredRequest_WhenNextRequest_ReportUnanswered(){
+    BusSniffer sniffer{};
+    snifferCount = 0;
+    sniffer.setOnTransactionCB(snifferCollect);
+
+    sniffer.parse(SnifferRequest04, sizeof(SnifferRequest04), 0);
+    sniffer.parse(SnifferRequest03, sizeof(SnifferRequest03), 100);
+    assert(snifferCount == 1);
+    assert(!snifferLast.hasResponse);
+    assert(snifferLast.functionCode == 0x04);
+    assert(sniffer.unanswered() == 1);
+}
+
+void GivenGeneratedTransactions_WhenSniffed_PairAll(){
+    BusSniffer sniffer{};
+    TrafficGenerator generator{11};
+    uint8_t frame[MB_RTU_MAX_ADU];
+    snifferCount = 0;
+    snifferMismatch = false;
+    sniffer.setOnTransactionCB(snifferCompare);
+    generator.setMode(TrafficMode::transactions);
+    generator.setSlaves(1, 32);
+    generator.setByteCountLimit(MB_MAX_PDU - 6);
+
+    for (uint16_t i = 0; i < 500; i++){
+        GeneratedFrame request;
+        uint16_t len = generator.next(frame, request);
+        snifferExpected = request;
+        sniffer.parse(frame, len, 2 * i);
+        len = generator.next(frame, request);
+        sniffer.parse(frame, len, 2 * i + 1);
+    }
+    assert(snifferCount == 500);
+    assert(!snifferMismatch);
+}
+
+void GivenNoise_WhenSniffed_Resynchronize(){
+    BusSniffer sniffer{};
+    uint8_t noise[] {0x03, 0x44, 0x01};
+    snifferCount = 0;
+    sniffer.setOnTransactionCB(snifferCollect);
+
+    sniffer.parse(noise, sizeof(noise), 0);
+    sniffer.parse(SnifferRequest03, sizeof(SnifferRequest03), 1);
+    sniffer.parse(SnifferResponse03, sizeof(SnifferResponse03), 2);
+    sniffer.parse(SnifferRequest03, sizeof(SnifferRequest03), 3);
+    sniffer.parse(SnifferResponse03, sizeof(SnifferResponse03), 4);
+    assert(snifferLast.hasRequest && snifferLast.hasResponse);
+    assert(snifferLast.latency == 1);
+}
+
+void test_mbsniffer(){
+    printf("\n\n -- TEST SNIFFER STARTING -- \n\n");
+    GivenRequestAndResponse_WhenSniffed_ReturnPairedTransaction();
+    printf(".");
+    GivenEcho_WhenSniffed_DecideByPreviousRequest();
+    printf(".");
+    GivenException_WhenSniffed_ReturnException();
+    printf(".");
+    GivenExceptionWithoutRequest_WhenSniffed_ReportResponseOnly();
+    printf(".");
+    GivenUnansweredRequest_WhenNextRequest_ReportUnanswered();
+    printf(".");
+    GivenNoise_WhenSniffed_Resynchronize();
+    printf(".");
+    GivenGeneratedTransactions_WhenSniffed_PairAll();
+    printf(".");
+    printf("\nTEST DONE.");
+}
@@ -0,0 +1,285 @@
+#include "Arduino.h"
+#include "mbstore.h"
+
+uint8_t StoreResponse03[] {0x01, 0x03, 0x04, 0x0, 0x6, 0x0, 0x05, 0xDA, 0x31};
+
+uint64_t storeMemory[16 * MBSTORE_BLOCK_SIZE / 8];
+uint32_t storeRows{0};
+uint64_t storeLastTime{0};
+uint16_t storeLast[4];
+
+void storeCollect(SampleStore *store, uint8_t series, uint64_t timestamp, const uint16_t *values, uint16_t quantity){
+    assert(timestamp >= storeLastTime);
+    storeLastTime = timestamp;
+    memcpy(storeLast, values, 2 * min(quantity, uint16_t(4)));
+    storeRows++;
+}
+
+void storeRow(uint8_t *data, uint16_t quantity, uint16_t value){
+    for (uint16_t idx = 0; idx < quantity; idx++){
+        data[2 * idx] = highByte(uint16_t(value + idx));
+        data[2 * idx + 1] = lowByte(uint16_t(value + idx));
+    }
+}
+
+void GivenRows_WhenScanned_ReturnTimeRange(){
+    SampleStore store{};
+    assert(store.begin(reinterpret_cast<uint8_t*>(storeMemory), sizeof(storeMemory)));
+    int8_t id = store.addSeries(1, 0x03, 0, 4);
+    int8_t other = store.addSeries(2, 0x03, 0, 4);
+    uint8_t data[8];
+    for (uint16_t row = 0; row < 10; row++){
+        storeRow(data, 4, row * 100);
+        assert(store.append(id, 1000 + row * 10, data));
+        assert(store.append(other, 1000 + row * 10, data));
+    }
+
+    storeRows = 0;
+    storeLastTime = 0;
+    assert(store.scan(id, 1020, 1050, storeCollect) == 4);
+    assert(storeRows == 4);
+    assert(storeLastTime == 1050);
+    assert(storeLast[0] == 500 && storeLast[3] == 503);
+    assert(store.rows(id) == 10);
+}
+
+void GivenDeltaSeries_WhenAppended_RestartBlockOnJump(){
+    SampleStore store{};
+    store.begin(reinterpret_cast<uint8_t*>(storeMemory), sizeof(storeMemory));
+    int8_t plain = store.addSeries(1, 0x04, 0, 4);
+    int8_t id = store.addSeries(1, 0x04, 0, 4, true);
+    assert(store.capacity(id) > store.capacity(plain));
+
+    uint8_t data[8];
+    storeRow(data, 4, 1000);
+    store.append(id, 0, data);
+    storeRow(data, 4, 1100);
+    store.append(id, 1, data);
+    assert(store.usedBlocks() == 1);
+    storeRow(data, 4, 1200); // 200 from the first row of the block
+    store.append(id, 2, data);
+    assert(store.usedBlocks() == 2);
+    storeRow(data, 4, 0xFFF0);
+    store.append(id, 3, data);
+
+    storeRows = 0;
+    storeLastTime = 0;
+    assert(store.scan(id, 1, 2, storeCollect) == 2);
+    assert(storeLast[0] == 1200 && storeLast[3] == 1203);
+    assert(store.scan(id, 3, 3, storeCollect) == 1);
+    assert(storeLast[0] == 0xFFF0 && storeLast[3] == 0xFFF3);
+}
+
+void GivenFullMemory_WhenAppended_OverwriteOldestBlock(){
+    SampleStore store{};
+    store.begin(reinterpret_cast<uint8_t*>(storeMemory), sizeof(storeMemory));
+    uint16_t blocks = store.blocks();
+    int8_t id = store.addSeries(1, 0x03, 0, 4);
+    uint16_t capacity = store.capacity(id);
+    uint8_t data[8];
+    uint32_t total = uint32_t(blocks + 6) * capacity;
+    for (uint32_t row = 0; row < total; row++){
+        storeRow(data, 4, row);
+        store.append(id, row, data);
+    }
+
+    assert(store.usedBlocks() == blocks);
+    storeRows = 0;
+    storeLastTime = 0;
+    assert(store.scan(id, 0, 0xFFFFFFFF, storeCollect) == uint32_t(blocks) * capacity);
+    assert(storeLast[0] == uint16_t(total - 1));
+    assert(store.scan(id, 0, 6 * capacity - 1, nullptr) == 0);
+}
+
+void GivenTimeGap_WhenAppended_StartNewBlock(){
+    SampleStore store{};
+    store.begin(reinterpret_cast<uint8_t*>(storeMemory), sizeof(storeMemory));
+    int8_t id = store.addSeries(1, 0x03, 0, 1);
+    uint8_t data[2] {0x00, 0x01};
+    store.append(id, 10, data);
+    store.append(id, 10 + 0x10000, data);
+
+    assert(store.usedBlocks() == 2);
+    assert(store.scan(id, 0x10000, 0x20000, nullptr) == 1);
+}
+
+void GivenResponse_WhenAppended_CheckSeries(){
+    SampleStore store{};
+    store.begin(reinterpret_cast<uint8_t*>(storeMemory), sizeof(storeMemory));
+    int8_t id = store.addSeries(1, 0x03, 0, 2);
+    int8_t wrong = store.addSeries(1, 0x03, 0, 3);
+    ResponseParser parser{};
+    parser.parse(StoreResponse03, 9);
+
+    assert(store.append(id, 5, parser));
+    assert(!store.append(wrong, 5, parser));
+    storeRows = 0;
+    storeLastTime = 0;
+    store.scan(id, 0, 10, storeCollect);
+    assert(storeRows == 1);
+    assert(storeLast[0] == 6 && storeLast[1] == 5);
+}
+
+void GivenEpochTimestamps_WhenAppended_KeepOneBlock(){
+    SampleStore store{};
+    store.begin(reinterpret_cast<uint8_t*>(storeMemory), sizeof(storeMemory));
+    int8_t id = store.addSeries(1, 0x03, 0, 1);
+    uint64_t epoch = 1700000000000ULL; // milliseconds since 1970
+    uint8_t data[2];
+    for (uint16_t row = 0; row < 10; row++){
+        storeRow(data, 1, row);
+        assert(store.append(id, epoch + row * 1000, data));
+    }
+
+    assert(store.usedBlocks() == 1);
+    storeRows = 0;
+    storeLastTime = 0;
+    assert(store.scan(id, epoch + 2000, epoch + 5000, storeCollect) == 4);
+    assert(storeLastTime == epoch + 5000);
+    assert(storeLast[0] == 5);
+    assert(store.scan(id, 0, epoch - 1, nullptr) == 0);
+}
+
+void GivenFormattedMemory_WhenAttached_ReuseRows(){
+    uint8_t *memory = reinterpret_cast<uint8_t*>(storeMemory);
+    uint8_t data[4];
+    {
+        SampleStore store{};
+        store.begin(memory, sizeof(storeMemory));
+        store.addSeries(1, 0x03, 0, 2);
+        int8_t id = store.addSeries(2, 0x04, 10, 2, true);
+        for (uint16_t row = 0; row < 5; row++){
+            storeRow(data, 2, row);
+            store.append(id, 100 + row, data);
+        }
+    }
+
+    SampleStore store{};
+    assert(store.attach(memory, sizeof(storeMemory)));
+    assert(store.series() == 2);
+    assert(store.usedBlocks() == 1);
+    assert(store.rows(1) == 5);
+    storeRow(data, 2, 5);
+    assert(store.append(1, 105, data));
+    assert(store.usedBlocks() == 1);
+    storeRows = 0;
+    storeLastTime = 0;
+    assert(store.scan(1, 0, 200, storeCollect) == 6);
+    assert(storeLastTime == 105);
+    assert(storeLast[0] == 5 && storeLast[1] == 6);
+}
+
+void GivenForeignMemory_WhenStoreAttached_Reject(){
+    uint8_t *memory = reinterpret_cast<uint8_t*>(storeMemory);
+    SampleStore store{};
+    store.begin(memory, sizeof(storeMemory));
+    assert(!store.attach(memory, sizeof(storeMemory) - MBSTORE_BLOCK_SIZE));
+    assert(store.series() == 0);
+    assert(store.addSeries(1, 0x03, 0, 1) == -1);
+
+    memset(memory, 0xA5, sizeof(storeMemory));
+    assert(!store.attach(memory, sizeof(storeMemory)));
+    assert(store.begin(memory, sizeof(storeMemory)));
+    assert(store.attach(memory, sizeof(storeMemory)));
+    assert(store.series() == 0 && store.usedBlocks() == 0);
+}
+
+/*
+Formats a store with three rows of a delta series in one block.
+*/
+void storeFill(SampleStore &store){
+    uint8_t data[4];
+    store.begin(reinterpret_cast<uint8_t*>(storeMemory), sizeof(storeMemory));
+    int8_t id = store.addSeries(1, 0x03, 0, 2, true);
+    for (uint16_t row = 0; row < 3; row++){
+        storeRow(data, 2, row);
+        store.append(id, row, data);
+    }
+}
+
+void GivenCorruptStore_WhenAttached_Reject(){
+    uint8_t *memory = reinterpret_cast<uint8_t*>(storeMemory);
+    uint64_t copy[sizeof(storeMemory) / 8];
+    SampleStore store{};
+    storeFill(store);
+    memcpy(copy, storeMemory, sizeof(storeMemory));
+    uint8_t *block = memory + sizeof(storeMemory) - store.blocks() * MBSTORE_BLOCK_SIZE;
+    assert(store.attach(memory, sizeof(storeMemory)));
+
+    // series table: quantity, capacity, block and delta flag of series 0
+    uint8_t *series = memory + 16;
+    uint16_t offsets[] {4, 6, 8, 10};
+    for (uint8_t field = 0; field < 4; field++){
+        memcpy(storeMemory, copy, sizeof(storeMemory));
+        series[offsets[field]] = 0xEE;
+        series[offsets[field] + 1] = 0x7F;
+        assert(!store.attach(memory, sizeof(storeMemory)));
+        assert(store.series() == 0);
+    }
+
+    // header of the used block: series and rows
+    for (uint8_t field = 0; field < 3; field += 2){
+        memcpy(storeMemory, copy, sizeof(storeMemory));
+        block[field] = 0xEE;
+        block[field + 1] = 0x7F;
+        assert(!store.attach(memory, sizeof(storeMemory)));
+    }
+    memcpy(storeMemory, copy, sizeof(storeMemory));
+    assert(store.attach(memory, sizeof(storeMemory)));
+    assert(store.scan(0, 0, 10, nullptr) == 3);
+}
+
+void GivenOversizedSeries_WhenAdded_Reject(){
+    SampleStore store{};
+    store.begin(reinterpret_cast<uint8_t*>(storeMemory), sizeof(storeMemory));
+    assert(store.addSeries(1, 0x03, 0, 0) == -1);
+    assert(store.addSeries(1, 0x03, 0, MB_MAX_READ_REGISTERS, true) == -1);
+    assert(store.series() == 0);
+}
+
+void profile_store(){
+    SampleStore store{};
+    store.begin(reinterpret_cast<uint8_t*>(storeMemory), sizeof(storeMemory));
+    int8_t id = store.addSeries(1, 0x04, 0, 20);
+    uint8_t data[40];
+    unsigned long start = micros();
+    for (uint32_t row = 0; row < 100000; row++){
+        storeRow(data, 20, row & 0x3F);
+        store.append(id, row, data);
+    }
+    unsigned long appended = micros() - start;
+    start = micros();
+    uint32_t rows = 0;
+    for (uint8_t run = 0; run < 100; run++){
+        rows += store.scan(id, 0, 100000, nullptr);
+    }
+    unsigned long scanned = micros() - start;
+    printf("\nStore: 100000 rows of 20 registers appended in %lu us, %u rows scanned in %lu us\n",
+        appended, unsigned(rows), scanned);
+}
+
+void test_mbstore(){
+    printf("\n\n -- TEST STORE STARTING -- \n\n");
+    GivenRows_WhenScanned_ReturnTimeRange();
+    printf(".");
+    GivenDeltaSeries_WhenAppended_RestartBlockOnJump();
+    printf(".");
+    GivenFullMemory_WhenAppended_OverwriteOldestBlock();
+    printf(".");
+    GivenTimeGap_WhenAppended_StartNewBlock();
+    printf(".");
+    GivenResponse_WhenAppended_CheckSeries();
+    printf(".");
+    GivenEpochTimestamps_WhenAppended_KeepOneBlock();
+    printf(".");
+    GivenFormattedMemory_WhenAttached_ReuseRows();
+    printf(".");
+    GivenForeignMemory_WhenStoreAttached_Reject();
+    printf(".");
+    GivenCorruptStore_WhenAttached_Reject();
+    printf(".");
+    GivenOversizedSeries_WhenAdded_Reject();
+    printf(".");
+    profile_store();
+    printf("\nTEST DONE.");
+}
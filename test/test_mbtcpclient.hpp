@@ -0,0 +1,234 @@
+#include "Arduino.h"
+#include "mbtcpclient.h"
+
+uint8_t TCPClientRequest03[] {0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, 0x00, 0x00, 0x02};
+uint8_t TCPClientException[] {0x00, 0x01, 0x00, 0x00, 0x00, 0x03, 0x01, 0x83, 0x02};
+// protocol id 1, not modbus
+uint8_t TCPClientBadHeader[] {0x00, 0x01, 0x00, 0x01, 0x00, 0x03, 0x01, 0x83, 0x02};
+// MBAP length one byte longer than the PDU
+uint8_t TCPClientLongResponse[] {0x00, 0x01, 0x00, 0x00, 0x00, 0x08, 0x01, 0x03, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00};
+// MBAP length one byte shorter than the PDU
+uint8_t TCPClientShortResponse[] {0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x04, 0x00, 0x01, 0x00};
+
+// stand-in slave
+uint8_t tcpSent[16][MB_TCP_MAX_ADU];
+uint8_t tcpSentCount{0};
+uint8_t tcpDone{0};
+uint16_t tcpDoneIds[16];
+bool tcpTimedOut{false};
+TransactionFailure tcpFailure{TransactionFailure::none};
+
+void tcpClientWriter(ModbusTCPClient *client, const uint8_t *adu, uint16_t len){
+    memcpy(tcpSent[tcpSentCount++], adu, len);
+}
+
+void tcpClientOnTransaction(ModbusTCPClient *client, uint16_t transactionId, ResponseParser *parser){
+    if (!parser){
+        tcpTimedOut = true;
+        tcpFailure = client->failure();
+    } else if (parser->isComplete()){
+        assert(parser->functionCode() == 0x03);
+        assert(parser->byteCount() == 4);
+        assert(parser->data()[1] == lowByte(transactionId));
+    }
+    tcpDoneIds[tcpDone++] = transactionId;
+}
+
+void tcpClientReset(ModbusTCPClient &client){
+    tcpSentCount = 0;
+    tcpDone = 0;
+    tcpTimedOut = false;
+    tcpFailure = TransactionFailure::none;
+    client.setWriter(tcpClientWriter);
+    client.setOnTransactionCB(tcpClientOnTransaction);
+}
+
+// answers request idx with its transaction id in the payload
+void tcpClientRespond(ModbusTCPClient &client, uint8_t idx){
+    const uint8_t *request = tcpSent[idx];
+    uint16_t transactionId = ModbusFrame::getWord(request);
+    uint8_t data[4] {0x00, uint8_t(lowByte(transactionId)), 0x00, 0x00};
+    uint8_t rtu[16];
+    uint8_t adu[16];
+    uint16_t len = ModbusFrame::readResponse(rtu, request[6], request[7], data, 4);
+    len = ModbusFrame::rtuToTCP(adu, rtu, len, transactionId);
+    client.parse(adu, len, 0);
+}
+
+void GivenReadRequest_WhenSent_WriteADU(){
+    ModbusTCPClient client{};
+    tcpClientReset(client);
+
+    assert(client.read(1, 0x03, 0, 2, 0) == 1);
+    assert(tcpSentCount == 1);
+    assert(memcmp(tcpSent[0], TCPClientRequest03, sizeof(TCPClientRequest03)) == 0);
+}
+
+void GivenWindow_WhenRequested_KeepWindowInFlight(){
+    ModbusTCPClient client{};
+    tcpClientReset(client);
+    client.setWindow(3);
+
+    for (uint8_t i = 0; i < 5; i++){
+        client.read(1, 0x03, i, 2, 0);
+    }
+    assert(client.inFlight() == 3);
+    assert(client.queued() == 2);
+    assert(tcpSentCount == 3);
+    tcpClientRespond(client, 1);
+    assert(tcpSentCount == 4);
+}
+
+void GivenInterleavedResponses_WhenParsed_CompleteOutOfOrder(){
+    ModbusTCPClient client{};
+    tcpClientReset(client);
+
+    for (uint8_t i = 0; i < 3; i++){
+        client.read(1, 0x03, i, 2, 0);
+    }
+    tcpClientRespond(client, 2);
+    tcpClientRespond(client, 0);
+    tcpClientRespond(client, 1);
+    assert(tcpDone == 3);
+    assert(tcpDoneIds[0] == 3);
+    assert(tcpDoneIds[1] == 1);
+    assert(tcpDoneIds[2] == 2);
+    assert(client.inFlight() == 0);
+}
+
+void GivenFragmentedStream_WhenParsed_Complete(){
+    ModbusTCPClient client{};
+    tcpClientReset(client);
+
+    client.read(1, 0x03, 0, 2, 0);
+    uint8_t adu[] {0x00, 0x01, 0x00, 0x00, 0x00, 0x07, 0x01, 0x03, 0x04, 0x00, 0x01, 0x00, 0x00};
+    for (uint8_t i = 0; i < sizeof(adu); i++){
+        client.parse(adu + i, 1, 0);
+    }
+    assert(tcpDone == 1);
+}
+
+void GivenException_WhenParsed_CompleteWithException(){
+    ModbusTCPClient client{};
+    tcpClientReset(client);
+    client.setOnTransactionCB([](ModbusTCPClient *client, uint16_t transactionId, ResponseParser *parser){
+        assert(parser->isException());
+        assert(parser->functionCode() == 0x03);
+        assert(parser->errorCode() == ErrorCode::illegalDataAddress);
+        tcpDone++;
+    });
+
+    client.read(1, 0x03, 0, 2, 0);
+    client.parse(TCPClientException, sizeof(TCPClientException), 0);
+    assert(tcpDone == 1);
+}
+
+void GivenSilentSlave_WhenTimedOut_CompleteWithNull(){
+    ModbusTCPClient client{};
+    tcpClientReset(client);
+    client.setTimeout(100);
+
+    client.read(1, 0x03, 0, 2, 0);
+    client.poll(99);
+    assert(!tcpTimedOut);
+    client.poll(100);
+    assert(tcpTimedOut);
+    assert(tcpFailure == TransactionFailure::timeout);
+    assert(client.inFlight() == 0);
+}
+
+void GivenInvalidHeader_WhenParsed_FailAllUntilReset(){
+    ModbusTCPClient client{};
+    tcpClientReset(client);
+    client.setWindow(1);
+
+    client.read(1, 0x03, 0, 2, 0);
+    client.read(1, 0x03, 2, 2, 0);
+    client.parse(TCPClientBadHeader, sizeof(TCPClientBadHeader), 0);
+    assert(tcpDone == 2);
+    assert(tcpFailure == TransactionFailure::syncLost);
+    assert(client.isSyncLost());
+    assert(client.syncErrors() == 1);
+    assert(client.inFlight() == 0 && client.queued() == 0);
+    assert(client.read(1, 0x03, 0, 2, 0) == -1);
+    assert(tcpSentCount == 1);
+
+    client.reset();
+    assert(!client.isSyncLost());
+    assert(client.read(1, 0x03, 0, 2, 0) > 0);
+    tcpClientRespond(client, 1);
+    assert(tcpDone == 3);
+}
+
+void GivenLengthMismatch_WhenParsed_FailMalformed(){
+    ModbusTCPClient client{};
+    tcpClientReset(client);
+
+    client.read(1, 0x03, 0, 2, 0);
+    client.parse(TCPClientLongResponse, sizeof(TCPClientLongResponse), 0);
+    assert(tcpDone == 1);
+    assert(tcpFailure == TransactionFailure::malformedResponse);
+
+    tcpFailure = TransactionFailure::none;
+    client.read(1, 0x03, 0, 2, 0);
+    uint8_t adu[sizeof(TCPClientShortResponse)];
+    memcpy(adu, TCPClientShortResponse, sizeof(adu));
+    adu[1] = tcpSent[1][1];
+    client.parse(adu, sizeof(adu), 0);
+    assert(tcpDone == 2);
+    assert(tcpFailure == TransactionFailure::malformedResponse);
+    assert(!client.isSyncLost());
+}
+
+/*
+Counts the round trips to finish 8 transactions
+when the stand-in slave answers all outstanding requests once per round trip.
+*/
+uint8_t tcpClientRoundTrips(uint8_t window){
+    ModbusTCPClient client{};
+    tcpClientReset(client);
+    client.setWindow(window);
+    for (uint8_t i = 0; i < 8; i++){
+        client.read(1, 0x03, i, 2, 0);
+    }
+    uint8_t rounds = 0;
+    uint8_t answered = 0;
+    while (tcpDone < 8){
+        uint8_t sent = tcpSentCount;
+        for (uint8_t idx = sent; idx > answered; idx--){
+            tcpClientRespond(client, idx - 1);
+        }
+        answered = sent;
+        rounds++;
+    }
+    return rounds;
+}
+
+void GivenWindow_WhenPipelined_BeatStopAndWait(){
+    assert(tcpClientRoundTrips(1) == 8);
+    assert(tcpClientRoundTrips(4) == 2);
+    assert(tcpClientRoundTrips(8) == 1);
+}
+
+void test_mbtcpclient(){
+    printf("\n\n -- TEST TCP CLIENT STARTING -- \n\n");
+    GivenReadRequest_WhenSent_WriteADU();
+    printf(".");
+    GivenWindow_WhenRequested_KeepWindowInFlight();
+    printf(".");
+    GivenInterleavedResponses_WhenParsed_CompleteOutOfOrder();
+    printf(".");
+    GivenFragmentedStream_WhenParsed_Complete();
+    printf(".");
+    GivenException_WhenParsed_CompleteWithException();
+    printf(".");
+    GivenSilentSlave_WhenTimedOut_CompleteWithNull();
+    printf(".");
+    GivenInvalidHeader_WhenParsed_FailAllUntilReset();
+    printf(".");
+    GivenLengthMismatch_WhenParsed_FailMalformed();
+    printf(".");
+    GivenWindow_WhenPipelined_BeatStopAndWait();
+    printf(".");
+    printf("\nTEST DONE.");
+}
@@ -0,0 +1,224 @@
+#include "Arduino.h"
+#include "mbtrace.h"
+#include "mbframe.h"
+
+uint8_t TraceResponse03[] {0x01, 0x03, 0x04, 0x0, 0x6, 0x0, 0x05, 0xDA, 0x31};
+uint8_t TraceBadCRC03[] {0x01, 0x03, 0x04, 0x0, 0x6, 0x0, 0x05, 0xDA, 0x32};
+uint8_t TraceException03[] {0x01, 0x83, 0x02, 0xC0, 0xF1};
+
+uint32_t traceMemory[64];
+unsigned long traceTicks{0};
+uint32_t traceWritten{0};
+
+unsigned long traceClock(){
+    return traceTicks++;
+}
+
+void traceWriter(FrameTracer *tracer, const uint8_t *data, uint16_t len){
+    assert(len % sizeof(TraceRecord) == 0);
+    traceWritten += len / sizeof(TraceRecord);
+}
+
+void GivenFrames_WhenParsed_RecordOnePerFrame(){
+    FrameTracer tracer{};
+    assert(tracer.begin(reinterpret_cast<uint8_t*>(traceMemory), sizeof(traceMemory)));
+    tracer.setClock(traceClock);
+    traceTicks = 100;
+    ResponseParser parser{};
+    parser.setObserver(&tracer, 2, true);
+
+    parser.parse(TraceResponse03, sizeof(TraceResponse03));
+    parser.parse(TraceBadCRC03, sizeof(TraceBadCRC03));
+    parser.reset(); // parse of a buffer stops in error state
+    parser.parse(TraceException03, sizeof(TraceException03));
+    assert(tracer.recorded() == 3);
+
+    TraceRecord record;
+    assert(tracer.read(record));
+    assert(record.start == 100 && record.end == 101);
+    assert(record.source == 2 && record.slave == 1 && record.functionCode == 0x03);
+    assert(record.state == static_cast<uint8_t>(ParserState::complete));
+    assert(record.byteCount == 4 && record.consumed == 9);
+    assert(record.states & (1 << static_cast<uint8_t>(ParserState::data)));
+    assert(!(record.states & (1 << static_cast<uint8_t>(ParserState::modbusException))));
+
+    assert(tracer.read(record));
+    assert(record.state == static_cast<uint8_t>(ParserState::error));
+    assert(record.errorCode == static_cast<uint8_t>(ErrorCode::CRCError));
+    assert(record.consumed == 9);
+
+    assert(tracer.read(record));
+    assert(record.state == static_cast<uint8_t>(ParserState::exception));
+    assert(record.errorCode == static_cast<uint8_t>(ErrorCode::illegalDataAddress));
+    assert(record.consumed == 5);
+    assert(!tracer.read(record));
+}
+
+void GivenStreamingParser_WhenParsed_CountStreamedBytes(){
+    FrameTracer tracer{};
+    tracer.begin(reinterpret_cast<uint8_t*>(traceMemory), sizeof(traceMemory));
+    ResponseParser parser{};
+    parser.setObserver(&tracer);
+    parser.setOnDataCB([](ResponseParser *parser, const uint8_t *data, uint16_t len, uint16_t offset){});
+
+    parser.parse(TraceResponse03, sizeof(TraceResponse03));
+    TraceRecord record;
+    assert(tracer.read(record));
+    assert(record.state == static_cast<uint8_t>(ParserState::complete));
+    assert(record.consumed == 9);
+}
+
+void GivenSlowReader_WhenOverrun_KeepLatestRecords(){
+    FrameTracer tracer{};
+    tracer.begin(reinterpret_cast<uint8_t*>(traceMemory), 4 * 24);
+    assert(tracer.capacity() == 4);
+    tracer.setClock(traceClock);
+    traceTicks = 0;
+    ResponseParser parser{};
+    parser.setObserver(&tracer);
+    for (uint8_t idx = 0; idx < 10; idx++){
+        parser.parse(TraceResponse03, sizeof(TraceResponse03));
+    }
+
+    TraceRecord record;
+    assert(tracer.read(record));
+    assert(tracer.lost() == 7);
+    assert(record.start == 14);
+    traceWritten = 0;
+    assert(tracer.flush(traceWriter) == 2);
+    assert(traceWritten == 2);
+}
+
+void GivenNoClock_WhenParsed_RecordSetTime(){
+    FrameTracer tracer{};
+    tracer.begin(reinterpret_cast<uint8_t*>(traceMemory), sizeof(traceMemory));
+    ResponseParser parser{};
+    parser.setObserver(&tracer);
+    tracer.setTime(500);
+    parser.parse(TraceResponse03, 4);
+    tracer.setTime(520);
+    parser.parse(TraceResponse03 + 4, sizeof(TraceResponse03) - 4);
+
+    TraceRecord record;
+    assert(tracer.read(record));
+    assert(record.start == 500 && record.end == 520);
+    assert(record.states == 0);
+    assert(record.byteCount == 4);
+}
+
+FrameTracer *traceShared{nullptr};
+ResponseParser *traceOther{nullptr};
+bool traceNested{false};
+
+/*
+Clock which parses a frame of another parser while the tracer writes a record,
+like a second task preempting the first.
+*/
+unsigned long traceInterruptingClock(){
+    if (traceNested || traceTicks++ != 1){
+        return 0;
+    }
+    traceNested = true;
+    traceOther->parse(TraceException03, sizeof(TraceException03));
+    TraceRecord record;
+    // the record of the first parser is still written
+    assert(traceShared->recorded() == 2);
+    assert(!traceShared->read(record));
+    traceNested = false;
+    return 0;
+}
+
+void GivenTwoParsers_WhenFramesInterleave_KeepBothRecords(){
+    FrameTracer tracer{};
+    tracer.begin(reinterpret_cast<uint8_t*>(traceMemory), sizeof(traceMemory));
+    tracer.setClock(traceInterruptingClock);
+    ResponseParser first{};
+    ResponseParser second{};
+    first.setObserver(&tracer, 1);
+    second.setObserver(&tracer, 2);
+    traceShared = &tracer;
+    traceOther = &second;
+    traceTicks = 0;
+
+    first.parse(TraceResponse03, sizeof(TraceResponse03));
+    TraceRecord record;
+    assert(tracer.read(record));
+    assert(record.source == 1 && record.state == static_cast<uint8_t>(ParserState::complete));
+    assert(tracer.read(record));
+    assert(record.source == 2 && record.state == static_cast<uint8_t>(ParserState::exception));
+    assert(!tracer.read(record));
+    assert(tracer.lost() == 0);
+}
+
+void GivenDisabledTracer_WhenParsed_RecordNothing(){
+    FrameTracer tracer{};
+    tracer.begin(reinterpret_cast<uint8_t*>(traceMemory), sizeof(traceMemory));
+    tracer.setEnabled(false);
+    ResponseParser parser{};
+    parser.setObserver(&tracer);
+    parser.parse(TraceResponse03, sizeof(TraceResponse03));
+    assert(tracer.recorded() == 0);
+}
+
+/*
+Parse time of a 45 byte FC03 response without tracer, with micros as clock,
+with setTime instead of a clock and with micros and state tracking.
+Best of 5 runs, the overhead is printed in percent of the untraced parse time.
+*/
+/*
+The configurations run interleaved, best of 25 runs each, so a load change of the host hits all of them.
+*/
+void profile_trace(){
+    FrameTracer clocked{};
+    FrameTracer timed{};
+    clocked.begin(reinterpret_cast<uint8_t*>(traceMemory), sizeof(traceMemory) / 2);
+    timed.begin(reinterpret_cast<uint8_t*>(traceMemory) + sizeof(traceMemory) / 2, sizeof(traceMemory) / 2);
+    clocked.setClock(micros);
+    timed.setTime(micros());
+    uint8_t frame[MB_RTU_MAX_ADU];
+    uint8_t payload[40]{};
+    uint16_t len = ModbusFrame::readResponse(frame, 1, 0x03, payload, sizeof(payload));
+    const uint32_t frames = 20000;
+    const char *names[4] {"untraced", "micros", "setTime", "setTime and states"};
+    FrameTracer *tracers[4] {nullptr, &clocked, &timed, &timed};
+    ResponseParser parsers[4];
+    unsigned long best[4];
+    for (uint8_t config = 0; config < 4; config++){
+        parsers[config].setObserver(tracers[config], 0, config == 3);
+        best[config] = ~0UL;
+    }
+    for (uint8_t run = 0; run < 25; run++){
+        for (uint8_t config = 0; config < 4; config++){
+            uint32_t recorded = tracers[config] ? tracers[config]->recorded() : 0;
+            unsigned long start = micros();
+            for (uint32_t idx = 0; idx < frames; idx++){
+                parsers[config].parse(frame, len);
+            }
+            best[config] = min(best[config], micros() - start);
+            assert(!tracers[config] || tracers[config]->recorded() - recorded == frames);
+        }
+    }
+    printf("\nTrace: %u frames of %u bytes, untraced %lu us", unsigned(frames), len, best[0]);
+    for (uint8_t config = 1; config < 4; config++){
+        printf(", %s %+ld %%", names[config], long(100 * (long(best[config]) - long(best[0])) / long(best[0])));
+    }
+    printf("\n");
+}
+
+void test_mbtrace(){
+    printf("\n\n -- TEST TRACE STARTING -- \n\n");
+    GivenFrames_WhenParsed_RecordOnePerFrame();
+    printf(".");
+    GivenStreamingParser_WhenParsed_CountStreamedBytes();
+    printf(".");
+    GivenSlowReader_WhenOverrun_KeepLatestRecords();
+    printf(".");
+    GivenNoClock_WhenParsed_RecordSetTime();
+    printf(".");
+    GivenTwoParsers_WhenFramesInterleave_KeepBothRecords();
+    printf(".");
+    GivenDisabledTracer_WhenParsed_RecordNothing();
+    printf(".");
+    profile_trace();
+    printf("\nTEST DONE.");
+}
@@ -0,0 +1,179 @@
+#include "Arduino.h"
+#include "mbwrite.h"
+
+uint8_t writeFrame[MB_RTU_MAX_ADU];
+uint8_t writeResponse[MB_RTU_MAX_ADU];
+uint32_t writeDone{0};
+ErrorCode writeCode{ErrorCode::noError};
+
+void writeCollect(WriteCoalescer *coalescer, uint8_t write, ErrorCode code){
+    writeDone |= 1UL << write;
+    writeCode = code;
+}
+
+void writeReset(){
+    writeDone = 0;
+    writeCode = ErrorCode::noError;
+}
+
+void GivenAdjacentWrites_WhenPlanned_MergeIntoFC16(){
+    WriteCoalescer coalescer{};
+    writeReset();
+    coalescer.write(1, 0x06, 12, 3, writeCollect);
+    coalescer.write(1, 0x06, 10, 1, writeCollect);
+    coalescer.write(1, 0x06, 11, 2, writeCollect);
+
+    assert(coalescer.plan() == 1);
+    const WriteRequest &request = coalescer.request(0);
+    assert(request.functionCode == 0x10 && request.address == 10 && request.quantity == 3);
+    uint16_t len = coalescer.request(0, writeFrame);
+    assert(len == 9 + 6);
+    assert(writeFrame[6] == 6);
+    assert(writeFrame[8] == 1 && writeFrame[10] == 2 && writeFrame[12] == 3);
+    assert(ModbusFrame::checkCRC(writeFrame, len));
+
+    ResponseParser parser{};
+    parser.parse(writeResponse, ModbusFrame::writeMultipleResponse(writeResponse, 1, 0x10, 10, 3));
+    assert(coalescer.complete(0, parser));
+    assert(writeDone == 0x07);
+    assert(writeCode == ErrorCode::noError);
+    assert(coalescer.pending() == 0);
+}
+
+void GivenSameAddress_WhenPlanned_LastValueWins(){
+    WriteCoalescer coalescer{};
+    writeReset();
+    coalescer.write(1, 0x06, 5, 100, writeCollect);
+    coalescer.write(1, 0x06, 5, 200, writeCollect);
+
+    assert(coalescer.plan() == 1);
+    assert(coalescer.request(0).functionCode == 0x06);
+    coalescer.request(0, writeFrame);
+    assert(ModbusFrame::getWord(writeFrame + 4) == 200);
+
+    ResponseParser parser{};
+    parser.parse(writeFrame, 8); // a write single response is an echo
+    assert(coalescer.complete(0, parser));
+    assert(writeDone == 0x03);
+}
+
+void GivenOtherEchoValue_WhenCompleted_Reject(){
+    WriteCoalescer coalescer{};
+    writeReset();
+    coalescer.write(1, 0x06, 5, 200, writeCollect);
+    coalescer.plan();
+
+    ResponseParser parser{};
+    parser.parse(writeResponse, ModbusFrame::writeSingle(writeResponse, 1, 0x06, 5, 201));
+    assert(!coalescer.complete(0, parser));
+    assert(writeDone == 0);
+    parser.reset();
+    parser.parse(writeResponse, ModbusFrame::writeSingle(writeResponse, 1, 0x06, 5, 200));
+    assert(coalescer.complete(0, parser));
+    assert(writeDone == 0x01);
+}
+
+void GivenCoilsAndGaps_WhenPlanned_SplitByTableAndAddress(){
+    WriteCoalescer coalescer{};
+    coalescer.write(1, 0x05, 0, 1);
+    coalescer.write(1, 0x05, 1, 0);
+    coalescer.write(1, 0x05, 9, 1);
+    coalescer.write(1, 0x06, 0, 7);
+    coalescer.write(2, 0x05, 2, 1);
+    coalescer.write(1, 0x05, 3, 1);
+
+    assert(coalescer.plan() == 5);
+    const WriteRequest &coils = coalescer.request(0);
+    assert(coils.slave == 1 && coils.functionCode == 0x0F && coils.address == 0 && coils.quantity == 2);
+    assert(coalescer.request(1).functionCode == 0x05 && coalescer.request(1).address == 3);
+    assert(coalescer.request(2).functionCode == 0x05 && coalescer.request(2).address == 9);
+    assert(coalescer.request(3).functionCode == 0x06);
+    assert(coalescer.request(4).slave == 2);
+
+    coalescer.write(1, 0x05, 2, 1);
+    assert(coalescer.plan() == 4);
+    uint16_t len = coalescer.request(0, writeFrame);
+    assert(coalescer.request(0).quantity == 4);
+    assert(writeFrame[6] == 1 && writeFrame[7] == 0x0D);
+    assert(ModbusFrame::checkCRC(writeFrame, len));
+}
+
+void GivenLongRun_WhenPlanned_SplitAtByteCountLimit(){
+    WriteCoalescer coalescer{};
+    for (uint16_t address = 0; address < 30; address++){
+        coalescer.write(1, 0x06, address, address);
+    }
+    coalescer.setByteCountLimit(40);
+
+    assert(coalescer.plan() == 2);
+    assert(coalescer.request(0).quantity == 20);
+    assert(coalescer.request(1).address == 20 && coalescer.request(1).quantity == 10);
+}
+
+void GivenTooManyRequests_WhenPlanned_ReturnFailure(){
+    WriteCoalescer coalescer{};
+    assert(coalescer.plan() == 0);
+    for (uint16_t idx = 0; idx <= MBWRITE_MAX_REQUESTS; idx++){
+        coalescer.write(1, 0x06, 2 * idx, idx);
+    }
+    assert(coalescer.plan() == -1);
+    assert(coalescer.requests() == 0);
+}
+
+void GivenException_WhenCompleted_FailMergedWrites(){
+    WriteCoalescer coalescer{};
+    writeReset();
+    coalescer.write(1, 0x06, 10, 1, writeCollect);
+    coalescer.write(1, 0x06, 11, 2, writeCollect);
+    coalescer.write(1, 0x06, 20, 2, writeCollect);
+    coalescer.plan();
+
+    ResponseParser parser{};
+    parser.parse(writeResponse, ModbusFrame::exception(writeResponse, 1, 0x10, ErrorCode::illegalDataAddress));
+    assert(!coalescer.complete(1, parser));
+    assert(coalescer.complete(0, parser));
+    assert(writeDone == 0x03);
+    assert(writeCode == ErrorCode::illegalDataAddress);
+
+    coalescer.fail(1, ErrorCode::gatewayTargetFailed);
+    assert(writeDone == 0x07);
+    assert(writeCode == ErrorCode::gatewayTargetFailed);
+    coalescer.fail(1, ErrorCode::noError);
+    assert(writeCode == ErrorCode::gatewayTargetFailed);
+}
+
+void GivenExceptionCodeZero_WhenCompleted_ReportFailure(){
+    WriteCoalescer coalescer{};
+    writeReset();
+    coalescer.write(1, 0x06, 10, 1, writeCollect);
+    coalescer.plan();
+
+    uint8_t response[] {0x01, 0x86, 0x00, 0x00, 0x00};
+    ModbusFrame::appendCRC(response, 3);
+    ResponseParser parser{};
+    assert(parser.parse(response, sizeof(response)) == ParserState::exception);
+    assert(coalescer.complete(0, parser));
+    assert(writeDone == 0x01);
+    assert(writeCode == ErrorCode::slaveDeviceFailure);
+}
+
+void test_mbwrite(){
+    printf("\n\n -- TEST WRITE COALESCER STARTING -- \n\n");
+    GivenAdjacentWrites_WhenPlanned_MergeIntoFC16();
+    printf(".");
+    GivenSameAddress_WhenPlanned_LastValueWins();
+    printf(".");
+    GivenOtherEchoValue_WhenCompleted_Reject();
+    printf(".");
+    GivenCoilsAndGaps_WhenPlanned_SplitByTableAndAddress();
+    printf(".");
+    GivenLongRun_WhenPlanned_SplitAtByteCountLimit();
+    printf(".");
+    GivenTooManyRequests_WhenPlanned_ReturnFailure();
+    printf(".");
+    GivenException_WhenCompleted_FailMergedWrites();
+    printf(".");
+    GivenExceptionCodeZero_WhenCompleted_ReportFailure();
+    printf(".");
+    printf("\nTEST DONE.");
+}
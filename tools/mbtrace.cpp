@@ -0,0 +1,148 @@
+/*
+mbtrace.cpp
+
+Contains:
+Host tool for trace files written by FrameTracer::flush.
+
+Remarks:
+Build with: g++ -std=c++11 -O2 -I src tools/mbtrace.cpp -o mbtrace
+
+mbtrace json <trace> converts the trace to Chrome trace event JSON on stdout,
+open it with chrome://tracing or Perfetto. Process is the source, thread the slave.
+Timestamps are expected in microseconds, i.e. the tracer clock was micros.
+
+mbtrace replay <trace> rebuilds a frame of the same slave, function code, byte count and
+outcome for each record and feeds it through a ResponseParser at the recorded pace.
+It reports frames whose outcome differs and the parse time next to the recorded time.
+The payload of the original frames is not recorded, so replayed frames carry zeros.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef STD_FUNCTIONAL
+#include <functional> // before mbparser.h, which defines min and max
+#endif
+
+#include "mbtrace.h"
+#include "mbframe.h"
+
+static const char* stateName(uint8_t state){
+  switch (static_cast<ParserState>(state)){
+    case ParserState::complete:
+      return "complete";
+    case ParserState::exception:
+      return "exception";
+    default:
+      return "error";
+  }
+}
+
+static unsigned long now(){
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000UL + t.tv_nsec / 1000UL;
+}
+
+/*
+Builds a frame with the outcome of record.
+*/
+static uint16_t rebuild(const TraceRecord &record, uint8_t *frame){
+  static const uint8_t zeros[256]{};
+  uint16_t len;
+  if (record.state == static_cast<uint8_t>(ParserState::exception)){
+    return ModbusFrame::exception(frame, record.slave, record.functionCode, static_cast<ErrorCode>(record.errorCode));
+  }
+  switch (record.functionCode){
+    case 0x01:
+    case 0x02:
+    case 0x03:
+    case 0x04:
+      len = ModbusFrame::readResponse(frame, record.slave, record.functionCode, zeros, record.byteCount);
+      break;
+    case 0x05:
+    case 0x06:
+      len = ModbusFrame::writeSingle(frame, record.slave, record.functionCode, 0, 0);
+      break;
+    default:
+      len = ModbusFrame::writeMultipleResponse(frame, record.slave, record.functionCode, 0, 1);
+      break;
+  }
+  if (record.state == static_cast<uint8_t>(ParserState::error)){
+    if (record.errorCode == static_cast<uint8_t>(ErrorCode::CRCError)){
+      frame[len - 1] ^= 0xFF;
+    }
+    len = min(len, record.consumed);
+  }
+  return len;
+}
+
+static void toJSON(FILE *file){
+  TraceRecord record;
+  bool first = true;
+  printf("[\n");
+  while (fread(&record, sizeof(record), 1, file) == 1){
+    printf("%s{\"name\":\"FC%02X\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%u,\"dur\":%u,\"pid\":%u,\"tid\":%u,"
+           "\"args\":{\"byteCount\":%u,\"errorCode\":%u,\"consumed\":%u,\"states\":\"0x%04X\"}}",
+           first ? "" : ",\n", record.functionCode, stateName(record.state), unsigned(record.start),
+           unsigned(record.end - record.start), record.source, record.slave, record.byteCount,
+           record.errorCode, record.consumed, record.states);
+    first = false;
+  }
+  printf("\n]\n");
+}
+
+static void replay(FILE *file){
+  TraceRecord record;
+  ResponseParser parser{};
+  parser.setByteCountLimit(MB_MAX_PDU - 2);
+  uint8_t frame[MB_RTU_MAX_ADU];
+  uint32_t frames = 0;
+  uint32_t mismatches = 0;
+  unsigned long parsed = 0;
+  unsigned long recorded = 0;
+  uint32_t firstStart = 0;
+  unsigned long begin = now();
+  while (fread(&record, sizeof(record), 1, file) == 1){
+    if (frames == 0){
+      firstStart = record.start;
+    }
+    uint16_t len = rebuild(record, frame);
+    // wait for the recorded start of the frame
+    while (now() - begin < record.start - firstStart){
+    }
+    parser.reset();
+    unsigned long start = now();
+    ParserState state = parser.parse(frame, len);
+    parsed += now() - start;
+    recorded += record.end - record.start;
+    if (static_cast<uint8_t>(state) != record.state){
+      mismatches++;
+      printf("frame %u: slave %u FC%02X recorded %s, replayed %s\n", unsigned(frames), record.slave,
+             record.functionCode, stateName(record.state), stateName(static_cast<uint8_t>(state)));
+    }
+    frames++;
+  }
+  printf("%u frames, %u mismatches, parse time %lu us, recorded time %lu us, replay took %lu us\n",
+         unsigned(frames), unsigned(mismatches), parsed, recorded, now() - begin);
+}
+
+int main(int argc, char **argv){
+  if (argc != 3 || (strcmp(argv[1], "json") != 0 && strcmp(argv[1], "replay") != 0)){
+    fprintf(stderr, "usage: mbtrace json|replay <trace>\n");
+    return 2;
+  }
+  FILE *file = fopen(argv[2], "rb");
+  if (!file){
+    fprintf(stderr, "cannot open %s\n", argv[2]);
+    return 1;
+  }
+  if (strcmp(argv[1], "json") == 0){
+    toJSON(file);
+  } else {
+    replay(file);
+  }
+  fclose(file);
+  return 0;
+}